@@ -0,0 +1,60 @@
+#include "animation.hpp"
+
+#include <algorithm>
+
+// Rotates v around a unit axis
+static Vec3 rotateAround(const Vec3 &v, const Vec3 &axis, const Float angle) {
+    const Float cosTheta = jtx::cos(angle);
+    const Float sinTheta = jtx::sin(angle);
+    return v * cosTheta + cross(axis, v) * sinTheta + axis * dot(axis, v) * (1.0f - cosTheta);
+}
+
+CameraProperties Animation::cameraAt(const Float time, const CameraProperties &base) const {
+    CameraProperties camera = base;
+
+    if (!keyframes.empty()) {
+        const auto next = std::ranges::upper_bound(keyframes, time, {}, &CameraKeyframe::time);
+        if (next == keyframes.begin() || next == keyframes.end()) {
+            // Hold the first and last keyframes outside of their range
+            const CameraKeyframe &key = next == keyframes.begin() ? keyframes.front() : keyframes.back();
+            camera.center             = key.center;
+            camera.target             = key.target;
+            if (key.yfov > 0) camera.yfov = key.yfov;
+        } else {
+            const CameraKeyframe &a = *(next - 1);
+            const CameraKeyframe &b = *next;
+            const Float s           = (time - a.time) / (b.time - a.time);
+            camera.center           = a.center + (b.center - a.center) * s;
+            camera.target           = a.target + (b.target - a.target) * s;
+
+            const Float fovA = a.yfov > 0 ? a.yfov : base.yfov;
+            const Float fovB = b.yfov > 0 ? b.yfov : base.yfov;
+            camera.yfov      = fovA + (fovB - fovA) * s;
+        }
+    }
+
+    if (orbit != 0 && duration > 0) {
+        const Float angle = 2 * PI * orbit * time / duration;
+        camera.center     = camera.target + rotateAround(camera.center - camera.target, normalize(camera.up), angle);
+    }
+    return camera;
+}
+
+std::string framePath(const std::string &pattern, const int frame) {
+    std::string number = std::to_string(frame);
+
+    const auto first = pattern.find('#');
+    if (first != std::string::npos) {
+        const auto last    = pattern.find_first_not_of('#', first);
+        const size_t width = (last == std::string::npos ? pattern.size() : last) - first;
+        if (number.size() < width) number.insert(0, width - number.size(), '0');
+        return pattern.substr(0, first) + number + (last == std::string::npos ? "" : pattern.substr(last));
+    }
+
+    // Before the extension, if there is one in the file name
+    if (number.size() < 4) number.insert(0, 4 - number.size(), '0');
+    const auto dot   = pattern.find_last_of('.');
+    const auto slash = pattern.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return pattern + "_" + number;
+    return pattern.substr(0, dot) + "_" + number + pattern.substr(dot);
+}
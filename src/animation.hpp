@@ -0,0 +1,46 @@
+#pragma once
+
+#include "scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+struct CameraKeyframe {
+    Float time;
+    Vec3 center;
+    Vec3 target;
+    // 0 keeps the field of view of the base camera
+    Float yfov = 0;
+};
+
+/**
+ * Camera animation: keyframes interpolated linearly, plus an optional orbit of the camera around its target
+ */
+struct Animation {
+    Float fps      = 30;
+    Float duration = 5;
+    // Sorted by time
+    std::vector<CameraKeyframe> keyframes;
+    // Full turns of the camera around its target over the whole animation, on top of the keyframes
+    Float orbit = 0;
+
+    int frameCount() const { return std::max(1, static_cast<int>(std::lround(fps * duration))); }
+
+    /**
+     * Evaluates the camera at a point in time
+     * @param time Seconds from the start of the animation
+     * @param base Camera the animation starts from, supplies everything the keyframes don't set
+     * @return Camera properties at time
+     */
+    CameraProperties cameraAt(Float time, const CameraProperties &base) const;
+};
+
+/**
+ * Output path of a frame. A run of '#' in the pattern is replaced with the zero-padded frame number, without one the
+ * number is appended to the file name.
+ * @param pattern Output path pattern, e.g. frames/shot_####.png
+ * @param frame Frame number
+ */
+std::string framePath(const std::string &pattern, int frame);
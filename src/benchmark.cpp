@@ -0,0 +1,314 @@
+#include "camera.hpp"
+#include "integrator.hpp"
+#include "job.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+#include "util/rand.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Rays handed to one traversal task
+static constexpr size_t RAY_BATCH = 4096;
+
+static double seconds(const Clock::time_point start, const Clock::time_point end) {
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [--<option> <value>]...\n"
+              << "\n"
+              << "Times BVH builds, ray traversal and rendering on the bundled scenes and reports the results as JSON.\n"
+              << "Scenes whose files are missing are skipped.\n"
+              << "\n"
+              << "  --output   JSON file to write, - for stdout (default -)\n"
+              << "  --scenes   Comma separated subset of shaderball, shaderball_hsd, knob, bunny, helmet, cornell_box\n"
+              << "  --width    Width of the traversal and render images (default 512)\n"
+              << "  --height   Height of the traversal and render images (default 256)\n"
+              << "  --spp      Samples per pixel of the integrator renders (default 4)\n"
+              << "  --repeat   Traversal runs per measurement, the fastest counts (default 3)\n"
+              << "  --threads  Worker threads, 0 for all cores (default 0)\n";
+}
+
+struct BenchmarkSettings {
+    std::string output = "-";
+    std::vector<std::string> scenes;
+    int width   = 512;
+    int height  = 256;
+    int spp     = 4;
+    int repeat  = 3;
+    int threads = 0;
+};
+
+struct BenchmarkScene {
+    const char *name;
+    // Checked before loading, so a missing asset skips the scene instead of failing the load
+    const char *path;
+    std::function<Scene()> create;
+    // File scenes come with a generic camera, point it at the model instead
+    bool frame;
+};
+
+static const BenchmarkScene SCENES[] = {
+        {"shaderball", "assets/scenes/shaderball/shaderball.obj", [] { return createShaderBallSceneWithLight(false); }, false},
+        {"shaderball_hsd", "assets/scenes/shaderball/shaderball_hsd.obj", [] { return createShaderBallSceneWithLight(true); }, false},
+        {"knob", "assets/scenes/knob.obj", [] { return createKnobScene(); }, false},
+        {"bunny", "assets/scenes/bunny.obj", [] { return createScene("assets/scenes/bunny.obj", Mat4::identity()); }, true},
+        {"helmet", "assets/scenes/helmet.glb", [] { return createScene("assets/scenes/helmet.glb", Mat4::identity()); }, true},
+        {"cornell_box", "assets/scenes/cornell_box.obj", [] { return createScene("assets/scenes/cornell_box.obj", Mat4::identity()); }, true},
+};
+
+// Exposes the camera's ray generation, so the primary rays are the ones a render would trace
+class RayCamera : public Camera {
+public:
+    using Camera::Camera;
+    using Camera::getRay;
+    using Camera::init;
+};
+
+static void frameScene(Scene &scene) {
+    const AABB bounds  = scene.bounds();
+    const Vec3 center  = (bounds.pmin + bounds.pmax) * 0.5f;
+    const Float radius = scene.getSceneRadius();
+
+    auto &camera         = scene.cameraProperties;
+    camera.target        = center;
+    camera.center        = center + Vec3(0, radius * 0.5f, radius * 3.5f);
+    camera.focusDistance = 1;
+    camera.defocusAngle  = 0;
+}
+
+// One ray per pixel through a jittered point, as the first sample of a render
+static std::vector<Ray> primaryRays(const Scene &scene, const BenchmarkSettings &settings) {
+    RayCamera camera{settings.width, settings.height, scene.cameraProperties, 1, 1, 1};
+    camera.init();
+
+    std::vector<Ray> rays;
+    rays.reserve(static_cast<size_t>(settings.width) * settings.height);
+    for (int row = 0; row < settings.height; ++row) {
+        for (int col = 0; col < settings.width; ++col) {
+            RNG rng(row, col, 1);
+            rays.push_back(camera.getRay(col, row, 0, rng));
+        }
+    }
+    return rays;
+}
+
+// Rays leaving the primary hits in uniformly random directions, like the diffuse bounces that dominate path
+// tracing. Primary rays that miss start from random points inside the scene bounds instead.
+static std::vector<Ray> incoherentRays(const Scene &scene, const std::vector<Ray> &primary) {
+    const AABB bounds = scene.bounds();
+    std::vector<Ray> rays(primary.size());
+
+    Scheduler::global().parallelFor((primary.size() + RAY_BATCH - 1) / RAY_BATCH, [&](const size_t batch) {
+        const size_t end = std::min((batch + 1) * RAY_BATCH, primary.size());
+        for (size_t i = batch * RAY_BATCH; i < end; ++i) {
+            RNG rng(static_cast<uint32_t>(i), 0, 2);
+            const Vec3 dir = rng.sampleUnitVector();
+
+            SurfaceIntersection record;
+            if (scene.closestHit(primary[i], Interval(0.001, INF), record)) {
+                rays[i] = Ray(record.point + dir * RAY_EPSILON, dir);
+            } else {
+                const Vec3 u(rng.sample<Float>(), rng.sample<Float>(), rng.sample<Float>());
+                rays[i] = Ray(bounds.pmin + u * (bounds.pmax - bounds.pmin), dir);
+            }
+        }
+    });
+    return rays;
+}
+
+/**
+ * Traces every ray with closestHit or anyHit on the scheduler, repeat times over
+ * @return Best throughput in millions of rays per second
+ */
+static double traceRays(const Scene &scene, const std::vector<Ray> &rays, const bool closest, const int repeat) {
+    const size_t batches = (rays.size() + RAY_BATCH - 1) / RAY_BATCH;
+    std::vector<int> hits(batches);
+
+    double best = 0;
+    for (int run = 0; run < repeat; ++run) {
+        const auto start = Clock::now();
+        Scheduler::global().parallelFor(batches, [&](const size_t batch) {
+            const size_t end = std::min((batch + 1) * RAY_BATCH, rays.size());
+            int count        = 0;
+            for (size_t i = batch * RAY_BATCH; i < end; ++i) {
+                SurfaceIntersection record;
+                count += closest ? scene.closestHit(rays[i], Interval(0.001, INF), record) : scene.anyHit(rays[i], Interval(0.001, INF));
+            }
+            // Keeps the traversal from being optimized away
+            hits[batch] = count;
+        });
+        const double elapsed = seconds(start, Clock::now());
+        if (elapsed > 0) best = std::max(best, static_cast<double>(rays.size()) / elapsed / 1e6);
+    }
+    return best;
+}
+
+static const char *integratorName(const IntegratorType type) {
+    switch (type) {
+        case IntegratorType::BASIC:
+            return "basic";
+        case IntegratorType::PATH:
+            return "path";
+        default:
+            return "mis";
+    }
+}
+
+// Measures one scene and appends its JSON object to out
+static bool benchmarkScene(const BenchmarkScene &entry, const BenchmarkSettings &settings, std::ostream &out) {
+    if (!std::filesystem::exists(entry.path)) {
+        std::cerr << "Skipping " << entry.name << ", missing " << entry.path << std::endl;
+        return false;
+    }
+    std::cerr << "Benchmarking " << entry.name << std::endl;
+
+    auto start            = Clock::now();
+    Scene scene           = entry.create();
+    const double loadTime = seconds(start, Clock::now());
+
+    start = Clock::now();
+    scene.buildBVH();
+    const double bvhTime = seconds(start, Clock::now());
+    if (entry.frame) frameScene(scene);
+
+    const auto primary    = primaryRays(scene, settings);
+    const auto incoherent = incoherentRays(scene, primary);
+
+    out << "    {\n"
+        << "      \"name\": \"" << entry.name << "\",\n"
+        << "      \"triangles\": " << scene.numPrimitives() << ",\n"
+        << "      \"load_seconds\": " << loadTime << ",\n"
+        << "      \"bvh_build_seconds\": " << bvhTime << ",\n"
+        << "      \"traversal_mrays_per_second\": {\n"
+        << "        \"primary_closest_hit\": " << traceRays(scene, primary, true, settings.repeat) << ",\n"
+        << "        \"primary_any_hit\": " << traceRays(scene, primary, false, settings.repeat) << ",\n"
+        << "        \"incoherent_closest_hit\": " << traceRays(scene, incoherent, true, settings.repeat) << ",\n"
+        << "        \"incoherent_any_hit\": " << traceRays(scene, incoherent, false, settings.repeat) << "\n"
+        << "      },\n"
+        << "      \"samples_per_second\": {\n";
+
+    const IntegratorType integrators[] = {IntegratorType::BASIC, IntegratorType::PATH, IntegratorType::MIS};
+    const auto [xSamples, ySamples]    = strataForSpp(settings.spp);
+    for (size_t i = 0; i < std::size(integrators); ++i) {
+        StaticCamera camera{settings.width, settings.height, scene.cameraProperties, xSamples, ySamples, 50};
+        camera.integrator_ = integrators[i];
+
+        start = Clock::now();
+        camera.render(scene);
+        const double elapsed = seconds(start, Clock::now());
+
+        const double samples = static_cast<double>(settings.width) * settings.height * settings.spp;
+        out << "        \"" << integratorName(integrators[i]) << "\": " << (elapsed > 0 ? samples / elapsed : 0)
+            << (i + 1 < std::size(integrators) ? ",\n" : "\n");
+    }
+    out << "      }\n"
+        << "    }";
+
+    scene.destroy();
+    return true;
+}
+
+static bool parseArgs(const int argc, char *argv[], BenchmarkSettings &settings) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+
+        auto number = [&](int &out, const int min) {
+            if (parseNumber(value, out) && out >= min) return true;
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return false;
+        };
+
+        bool valid = true;
+        if (arg == "--output") {
+            settings.output = value;
+        } else if (arg == "--scenes") {
+            std::stringstream list(value);
+            for (std::string name; std::getline(list, name, ',');) {
+                // A typo would otherwise quietly benchmark nothing
+                if (std::ranges::none_of(SCENES, [&](const BenchmarkScene &entry) { return entry.name == name; })) {
+                    std::cerr << "Unknown scene: " << name << std::endl;
+                    return false;
+                }
+                settings.scenes.push_back(name);
+            }
+        } else if (arg == "--width") {
+            valid = number(settings.width, 1);
+        } else if (arg == "--height") {
+            valid = number(settings.height, 1);
+        } else if (arg == "--spp") {
+            valid = number(settings.spp, 1);
+        } else if (arg == "--repeat") {
+            valid = number(settings.repeat, 1);
+        } else if (arg == "--threads") {
+            valid = number(settings.threads, 0);
+        } else {
+            std::cerr << "Unexpected argument: " << arg << std::endl;
+            valid = false;
+        }
+        if (!valid) return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+
+    BenchmarkSettings settings;
+    if (!parseArgs(argc, argv, settings)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (settings.threads > 0) Scheduler::setGlobalThreadCount(settings.threads);
+
+    std::ostringstream json;
+    json << "{\n"
+         << "  \"threads\": " << Scheduler::global().threadCount() + 1 << ",\n"
+         << "  \"width\": " << settings.width << ",\n"
+         << "  \"height\": " << settings.height << ",\n"
+         << "  \"spp\": " << settings.spp << ",\n"
+         << "  \"scenes\": [\n";
+
+    bool first = true;
+    for (const auto &entry : SCENES) {
+        if (!settings.scenes.empty() && std::ranges::find(settings.scenes, entry.name) == settings.scenes.end()) continue;
+
+        std::ostringstream result;
+        if (!benchmarkScene(entry, settings, result)) continue;
+        json << (first ? "" : ",\n") << result.str();
+        first = false;
+    }
+    json << "\n  ]\n}\n";
+
+    if (settings.output == "-") {
+        std::cout << json.str() << std::flush;
+        return 0;
+    }
+    std::ofstream file(settings.output);
+    if (!(file << json.str())) {
+        std::cerr << "Failed to write " << settings.output << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "bsdf.hpp"
+#include "../material.hpp"
+#include "../scene.hpp"
+
+BSDF::BSDF(const Scene &scene, const SurfaceIntersection &rec)
+    : frame_(jtx::Frame::fromZ(rec.normal)) {
+    const Material *mat     = rec.material;
+    const Float filterWidth = rec.uvFootprint();
+
+    switch (mat->type) {
+        case Material::METALLIC_ROUGHNESS: {
+            Vec3 albedo = mat->albedo;
+            if (mat->albedoTexId != -1) {
+                albedo = scene.textures[mat->albedoTexId].sample(rec.uv, filterWidth);
+            }
+
+            float metallic  = mat->alphaX;
+            float roughness = mat->alphaY;
+            if (mat->metallicRoughnessTexId != -1) {
+                const auto mr = scene.textures[mat->metallicRoughnessTexId].sample(rec.uv, filterWidth);
+                roughness     = mr.y;
+                metallic      = mr.z;
+            }
+
+            albedo_ = albedo;
+            bxdf_.emplace<MetallicRoughnessBxDF>(roughness * roughness, albedo, metallic);
+            break;
+        }
+        case Material::DIFFUSE: {
+            // If material has a diffuse texture, we should use that
+            Vec3 albedo = mat->albedo;
+            if (mat->albedoTexId != -1) {
+                albedo = scene.textures[mat->albedoTexId].sample(rec.uv, filterWidth);
+            }
+
+            albedo_ = albedo;
+            bxdf_.emplace<DiffuseBxDF>(albedo);
+            break;
+        }
+        case Material::CONDUCTOR:
+            bxdf_.emplace<ConductorBxDF>(GGX{mat->alphaX, mat->alphaY}, mat->IOR, mat->k);
+            break;
+        case Material::DIELECTRIC:
+            bxdf_.emplace<DielectricBxDF>(GGX{mat->alphaX, mat->alphaY}, mat->IOR.x);
+            break;
+        default:
+            break;
+    }
+}
+
+bool BSDF::sample(const Vec3 &w_o, const float uc, const Vec2f &u, BSDFSample &s) const {
+    const auto w_o_local = frame_.toLocal(w_o);
+    if (w_o_local.z == 0) return false;
+
+    return std::visit([&]<typename T>(const T &bxdf) {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return false;
+        } else {
+            if (!bxdf.sample(w_o_local, uc, u, s)) return false;
+            if (!s.fSample || s.pdf == 0 || s.w_i.z == 0) return false;
+            s.w_i = frame_.toWorld(s.w_i);
+            return true;
+        }
+    }, bxdf_);
+}
+
+Vec3 BSDF::evaluate(const Vec3 &w_o, const Vec3 &w_i) const {
+    const auto w_o_local = frame_.toLocal(w_o);
+    const auto w_i_local = frame_.toLocal(w_i);
+    if (w_o_local.z == 0 || w_i_local.z == 0) return {};
+
+    return std::visit([&]<typename T>(const T &bxdf) -> Vec3 {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return {};
+        } else {
+            return bxdf.evaluate(w_o_local, w_i_local);
+        }
+    }, bxdf_);
+}
+
+float BSDF::pdf(const Vec3 &w_o, const Vec3 &w_i) const {
+    const auto w_o_local = frame_.toLocal(w_o);
+    const auto w_i_local = frame_.toLocal(w_i);
+    if (w_o_local.z == 0 || w_i_local.z == 0) return 0;
+
+    return std::visit([&]<typename T>(const T &bxdf) -> float {
+        if constexpr (std::is_same_v<T, std::monostate>) {
+            return 0;
+        } else {
+            return bxdf.pdf(w_o_local, w_i_local);
+        }
+    }, bxdf_);
+}
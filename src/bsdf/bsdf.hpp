@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bxdf.hpp"
+#include "conductor.hpp"
+#include "dielectric.hpp"
+#include "diffuse.hpp"
+#include "gltf.hpp"
+
+#include <variant>
+
+/**
+ * BSDF at a single surface intersection
+ *
+ * Built once per hit: the shading frame, the texture lookups and the concrete BxDF are resolved in the
+ * constructor, so light sampling and BSDF sampling at the same vertex share them.
+ *
+ * All directions passed in and returned are in world space.
+ */
+class BSDF {
+public:
+    /**
+     * Constructor
+     * @param scene Scene owning the material textures
+     * @param rec Surface intersection to shade
+     */
+    BSDF(const Scene &scene, const SurfaceIntersection &rec);
+
+    /**
+     * @return True if the material resolved to a supported BxDF
+     */
+    [[nodiscard]] bool valid() const { return !std::holds_alternative<std::monostate>(bxdf_); }
+
+    /**
+     * @return Resolved surface colour (after texturing), white for conductors and dielectrics
+     */
+    [[nodiscard]] const Vec3 &albedo() const { return albedo_; }
+
+    bool sample(const Vec3 &w_o, float uc, const Vec2f &u, BSDFSample &s) const;
+
+    [[nodiscard]] Vec3 evaluate(const Vec3 &w_o, const Vec3 &w_i) const;
+
+    [[nodiscard]] float pdf(const Vec3 &w_o, const Vec3 &w_i) const;
+
+private:
+    jtx::Frame frame_;
+    Vec3 albedo_ = Color::WHITE;
+    std::variant<std::monostate, DiffuseBxDF, ConductorBxDF, DielectricBxDF, MetallicRoughnessBxDF> bxdf_;
+};
@@ -125,9 +125,4 @@ struct BSDFSample {
 };
 
 struct SurfaceIntersection;
-struct Material;
-class Scene;
-
-bool sampleBxdf(const Scene &scene, const SurfaceIntersection &rec, const Vec3 &w_o, const float uc, const Vec2f &u, BSDFSample &s);
-Vec3 evalBxdf(const Scene &scene, const Material *mat, const SurfaceIntersection &rec, const Vec3 &w_o, const Vec3 &w_i);
-float pdfBxdf(const Scene &scene, const Material *mat, const SurfaceIntersection &rec, const Vec3 &w_o, const Vec3 &w_i);
\ No newline at end of file
+class Scene;
\ No newline at end of file
@@ -34,7 +34,7 @@ public:
             const Vec3 w_i(-w_o.x, -w_o.y, w_o.z);
             const auto cosTheta_i = jtx::absCosTheta(w_i);
             const auto f          = fresnelComplexRGB(cosTheta_i, eta_, k_) / cosTheta_i;
-            s                     = {f, w_i, 1, true};
+            s                     = {f, w_i, 1, 0, true};
             return true;
         }
 
@@ -1,4 +1,8 @@
 #include "bvh.hpp"
+#include "scheduler.hpp"
+
+// Subtrees with more primitives than this are built in parallel
+static constexpr size_t BVH_PARALLEL_THRESHOLD = 64 * 1024;
 
 struct BVHBucket {
     int count = 0;
@@ -6,9 +10,9 @@ struct BVHBucket {
 };
 
 
-BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orderedPrimitiveOffset, std::vector<Triangle> &orderedPrimitives, int maxPrimsInNode) {
+BVHNode *buildTree(std::span<Triangle> bvhPrimitives, std::atomic<int> *totalNodes, std::atomic<int> *orderedPrimitiveOffset, std::vector<Triangle> &orderedPrimitives, int maxPrimsInNode) {
     const auto node = new BVHNode();
-    (*totalNodes)++;
+    totalNodes->fetch_add(1, std::memory_order_relaxed);
 
     AABB bounds;
     for (const auto &prim: bvhPrimitives) {
@@ -17,8 +21,7 @@ BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orde
 
     if (bounds.surfaceArea() == 0 || bvhPrimitives.size() == 1) {
         // CASE: single prim or empty bbox;
-        const int firstOffset = *orderedPrimitiveOffset;
-        *orderedPrimitiveOffset += bvhPrimitives.size();
+        const int firstOffset = orderedPrimitiveOffset->fetch_add(static_cast<int>(bvhPrimitives.size()));
         for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
             // const int index                    = ;
             orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
@@ -35,8 +38,7 @@ BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orde
 
         if (centroidBounds.pmin[dim] == centroidBounds.pmax[dim]) {
             // CASE: empty bbox
-            const int firstOffset = *orderedPrimitiveOffset;
-            *orderedPrimitiveOffset += bvhPrimitives.size();
+            const int firstOffset = orderedPrimitiveOffset->fetch_add(static_cast<int>(bvhPrimitives.size()));
             for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
                 // const int index                    = bvhPrimitives[i].index;
                 orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
@@ -112,8 +114,7 @@ BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orde
                 mid              = midIterator - bvhPrimitives.begin();
             } else {
                 // Build leaf node
-                const int firstOffset = *orderedPrimitiveOffset;
-                *orderedPrimitiveOffset += bvhPrimitives.size();
+                const int firstOffset = orderedPrimitiveOffset->fetch_add(static_cast<int>(bvhPrimitives.size()));
                 for (size_t i = 0; i < bvhPrimitives.size(); ++i) {
                     // const int index                    = bvhPrimitives[i].index;
                     orderedPrimitives[firstOffset + i] = bvhPrimitives[i];
@@ -124,8 +125,16 @@ BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orde
         }
 
         BVHNode *children[2];
-        children[0] = buildTree(bvhPrimitives.subspan(0, mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
-        children[1] = buildTree(bvhPrimitives.subspan(mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
+        if (bvhPrimitives.size() > BVH_PARALLEL_THRESHOLD) {
+            // Subtrees touch disjoint primitives, so large ones are built as separate tasks
+            Scheduler::TaskGroup group;
+            group.run([&] { children[0] = buildTree(bvhPrimitives.subspan(0, mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode); });
+            children[1] = buildTree(bvhPrimitives.subspan(mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
+            group.wait();
+        } else {
+            children[0] = buildTree(bvhPrimitives.subspan(0, mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
+            children[1] = buildTree(bvhPrimitives.subspan(mid), totalNodes, orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
+        }
         node->initBranch(dim, children[0], children[1]);
     }
 
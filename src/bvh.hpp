@@ -4,6 +4,8 @@
 #include "rt.hpp"
 #include "mesh.hpp"
 
+#include <atomic>
+
 struct alignas(32) LinearBVHNode {
     AABB bbox;
     union {
@@ -55,6 +57,6 @@ struct BVHNode {
     }
 };
 
-BVHNode *buildTree(std::span<Triangle> bvhPrimitives, int *totalNodes, int *orderedPrimitiveOffset, std::vector<Triangle> &orderedPrimitives, int maxPrimsInNode);
+BVHNode *buildTree(std::span<Triangle> bvhPrimitives, std::atomic<int> *totalNodes, std::atomic<int> *orderedPrimitiveOffset, std::vector<Triangle> &orderedPrimitives, int maxPrimsInNode);
 
 int flattenBVH(const BVHNode *node, LinearBVHNode *nodes, int *offset);
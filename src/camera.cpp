@@ -1,8 +1,44 @@
 #include "camera.hpp"
+#include "checkpoint.hpp"
+#include "framewriter.hpp"
 #include "integrator.hpp"
+#include "scheduler.hpp"
+#include "util/queue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+// Radiance cache cell size, relative to the scene radius
+static constexpr Float RADIANCE_CACHE_CELL_SCALE = 0.005f;
+
+// Largest distance between the old and new first hit for reprojected history to be kept, relative to the
+// distance from the previous camera
+static constexpr Float HISTORY_DISTANCE_TOLERANCE = 0.01f;
+// Smallest cosine between the old and new first-hit normals for reprojected history to be kept
+static constexpr Float HISTORY_MIN_NORMAL_COSINE = 0.9f;
+
+// Most triangles hashed into a render fingerprint, spread evenly over the scene
+static constexpr size_t FINGERPRINT_MAX_TRIANGLES = 4096;
+
+static constexpr uint64_t FNV_64_PRIME = 1099511628211ull;
+static constexpr uint64_t FNV_64_OFFST = 14695981039346656037ull;
+
+// FNV-1a over the bytes of a value, only for types without padding
+template<typename T>
+static void hashBytes(uint64_t &hash, const T *data, const size_t count) {
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < count * sizeof(T); ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_64_PRIME;
+    }
+}
 
-#include <barrier>
-#include <thread>
+template<typename T>
+static void hashValue(uint64_t &hash, const T &value) {
+    hashBytes(hash, &value, 1);
+}
 
 void Camera::init() {
     // Viewport dimensions
@@ -30,6 +66,177 @@ void Camera::init() {
     defocus_v_                = defocusRadius * v_;
 }
 
+void Camera::resetRadianceCache(const Scene &scene) {
+    if (!useRadianceCache_) return;
+    const Float radius = scene.getSceneRadius();
+    radianceCache_.clear(radius > 0 ? radius * RADIANCE_CACHE_CELL_SCALE : 1.0f);
+}
+
+uint64_t Camera::renderFingerprint(const Scene &scene) const {
+    uint64_t hash = FNV_64_OFFST;
+    hashBytes(hash, scene.name.data(), scene.name.size());
+    hashValue(hash, scene.triangles.size());
+    hashValue(hash, scene.meshes.size());
+    hashValue(hash, scene.materials.size());
+    hashValue(hash, scene.lights.size());
+    hashValue(hash, scene.skyColor);
+
+    const size_t stride = std::max<size_t>(1, scene.triangles.size() / FINGERPRINT_MAX_TRIANGLES);
+    for (size_t i = 0; i < scene.triangles.size(); i += stride) {
+        hashValue(hash, scene.triangles[i].bounds.pmin);
+        hashValue(hash, scene.triangles[i].bounds.pmax);
+    }
+
+    hashValue(hash, properties_.center);
+    hashValue(hash, properties_.target);
+    hashValue(hash, properties_.up);
+    hashValue(hash, properties_.yfov);
+    hashValue(hash, properties_.defocusAngle);
+    hashValue(hash, properties_.focusDistance);
+
+    hashValue(hash, integrator_);
+    hashValue(hash, maxDepth_);
+    hashValue(hash, maxSampleValue_);
+    hashValue(hash, useRadianceCache_);
+    return hash;
+}
+
+Vec3 Camera::integrateSample(const Ray &ray, const Scene &scene, RNG &rng, const RayDifferential &differential, PathInfo *info) {
+    switch (integrator_) {
+        case IntegratorType::BASIC:
+            return integrateBasic(ray, scene, maxDepth_, rng);
+        case IntegratorType::PATH:
+            return integrate(ray, scene, maxDepth_, rng);
+        default:
+            return integrateMIS(ray, scene, maxDepth_, false, rng, radianceCache(), differential, info);
+    }
+}
+
+bool Camera::save(const char *path) {
+    PROFILE_SCOPE("Save image");
+    const std::string p(path);
+    const bool isEXR = p.size() >= 4 && (p.ends_with(".exr") || p.ends_with(".EXR"));
+    if (isEXR) return traversal_.empty() ? acc_.saveEXR(path, tileSamples(), tileSize_) : saveHeatmapEXR(path);
+    return resolveImage().save(path);
+}
+
+void Camera::captureFrame(const std::string &path, Frame &frame) {
+    frame.path = path;
+    if (frame.isEXR()) {
+        frame.film        = acc_;
+        frame.tileSamples = tileSamples();
+        frame.tileSize    = tileSize_;
+    } else {
+        frame.image = resolveImage();
+    }
+}
+
+void Camera::exportFilm(Checkpoint &film) const {
+    film.reset(width_, height_, getSpp(), tileSize_, tiles_.size(), false);
+    film.maxSampleValue = maxSampleValue_;
+    film.fingerprint    = fingerprint_;
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        const auto &job = tiles_[i];
+        film.captureTile(acc_, nullptr, i, tileStates_[i].samples.load(std::memory_order_acquire), job.startRow, job.startCol, job.endRow, job.endCol);
+    }
+}
+
+const RGB8Image &Camera::resolveImage() {
+    std::lock_guard lock(resolveMutex_);
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        auto &tile       = tileStates_[i];
+        const uint32_t v = tile.version.load(std::memory_order_acquire);
+        if ((v & 1) || v == tile.resolvedVersion) continue;
+
+        const auto &job   = tiles_[i];
+        const int samples = tile.samples.load(std::memory_order_relaxed);
+        if (pixelWeights_) {
+            img_.resolveWeighted(acc_, pixelWeights_, static_cast<Float>(samples), job.startRow, job.startCol, job.endRow, job.endCol);
+        } else {
+            img_.resolve(acc_, 1.0f / static_cast<Float>(jtx::max(samples, 1)), job.startRow, job.startCol, job.endRow, job.endCol);
+        }
+
+        // A thread may have picked the tile up while we were reading it, in which case try again next time
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (tile.version.load(std::memory_order_relaxed) == v) tile.resolvedVersion = v;
+    }
+    return img_;
+}
+
+void Camera::presentImage(const std::vector<Vec3> &color) {
+    std::lock_guard lock(resolveMutex_);
+    for (int row = 0; row < height_; ++row) {
+        for (int col = 0; col < width_; ++col) {
+            img_.setPixel(color[row * width_ + col], row, col);
+        }
+    }
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        tileStates_[i].resolvedVersion = tileStates_[i].version.load(std::memory_order_acquire);
+    }
+}
+
+void Camera::traversalPerSample(std::vector<float> &nodes, std::vector<float> &triangles) const {
+    const size_t n = static_cast<size_t>(width_) * height_;
+    nodes.assign(n, 0.0f);
+    triangles.assign(n, 0.0f);
+
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        const auto &job = tiles_[i];
+        const float inv = 1.0f / static_cast<float>(jtx::max(tileStates_[i].samples.load(std::memory_order_acquire), 1));
+        for (auto row = job.startRow; row < job.endRow; ++row) {
+            for (auto col = job.startCol; col < job.endCol; ++col) {
+                const size_t p = row * width_ + col;
+                nodes[p]       = static_cast<float>(traversal_[p].nodes) * inv;
+                triangles[p]   = static_cast<float>(traversal_[p].triangles) * inv;
+            }
+        }
+    }
+}
+
+// Heatmap colours of the per-sample costs, in linear space
+static std::vector<Vec3> heatmapColors(const std::vector<float> &nodes, const std::vector<float> &triangles) {
+    std::vector<float> cost(nodes.size());
+    for (size_t i = 0; i < cost.size(); ++i) cost[i] = nodes[i] + triangles[i];
+
+    std::vector<float> sorted = cost;
+    const auto percentile     = sorted.begin() + static_cast<std::ptrdiff_t>(sorted.size() * 99 / 100);
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    const float scale = percentile != sorted.end() && *percentile > 0 ? 1.0f / *percentile : 0.0f;
+
+    std::vector<Vec3> colors(cost.size());
+    for (size_t i = 0; i < cost.size(); ++i) {
+        const Vec3 c = heatmapColor(cost[i] * scale);
+        colors[i]    = c * c;
+    }
+    return colors;
+}
+
+void Camera::presentHeatmap() {
+    std::vector<float> nodes, triangles;
+    traversalPerSample(nodes, triangles);
+    presentImage(heatmapColors(nodes, triangles));
+}
+
+bool Camera::saveHeatmapEXR(const char *path) {
+    std::vector<float> nodes, triangles;
+    traversalPerSample(nodes, triangles);
+    const auto colors = heatmapColors(nodes, triangles);
+
+    // EXR planes go top row first, B, G, R, nodes, triangles
+    std::vector<float> planes[5];
+    for (auto &plane : planes) plane.resize(colors.size());
+    for (int row = 0; row < height_; ++row) {
+        const size_t dst = static_cast<size_t>(height_ - 1 - row) * width_;
+        for (int col = 0; col < width_; ++col) {
+            const size_t src = static_cast<size_t>(row) * width_ + col;
+            for (int c = 0; c < 3; ++c) planes[c][dst + col] = colors[src][2 - c];
+            planes[3][dst + col] = nodes[src];
+            planes[4][dst + col] = triangles[src];
+        }
+    }
+    return saveEXRChannels(path, width_, height_, {{"B", planes[0].data()}, {"G", planes[1].data()}, {"R", planes[2].data()}, {"nodes", planes[3].data()}, {"triangles", planes[4].data()}});
+}
+
 void Camera::resize(const int w, const int h) {
     this->width_       = w;
     this->height_      = h;
@@ -40,91 +247,354 @@ void Camera::resize(const int w, const int h) {
 
     this->acc_.clear();
     this->acc_.resize(w, h);
+
+    this->aov_.clear();
+    this->aov_.resize(w, h);
+
+    this->traversal_.clear();
+
+    resetTiles(tileSize_);
+}
+
+void Camera::resetTiles(const int tileSize, const int samples) {
+    std::lock_guard lock(resolveMutex_);
+    tileSize_ = tileSize;
+    tiles_.clear();
+    for (int r = 0; r < height_; r += tileSize) {
+        for (int c = 0; c < width_; c += tileSize) {
+            RayTraceJob job{};
+            job.startRow = r;
+            job.startCol = c;
+            job.endRow   = std::min(r + tileSize, height_);
+            job.endCol   = std::min(c + tileSize, width_);
+            tiles_.push_back(job);
+        }
+    }
+    tileSchedule_ = tileSchedule((width_ + tileSize - 1) / tileSize, (height_ + tileSize - 1) / tileSize, tileOrder_);
+
+    tileStates_ = std::make_unique<TileState[]>(tiles_.size());
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        tileStates_[i].samples.store(samples, std::memory_order_relaxed);
+    }
+    completedSamples_ = static_cast<int64_t>(tiles_.size()) * samples;
+    targetSamples_    = static_cast<int64_t>(tiles_.size()) * getSpp();
+}
+
+std::vector<int> Camera::tileSamples() const {
+    std::vector<int> samples(tiles_.size());
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        samples[i] = tileStates_[i].samples.load(std::memory_order_acquire);
+    }
+    return samples;
+}
+
+static int64_t steadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Camera::initStats() {
+    workerSlots_ = Scheduler::global().threadCount() + 1;
+    workerStats_ = std::make_unique<WorkerStats[]>(workerSlots_);
+    renderStart_ = steadyNanos();
+}
+
+void Camera::resetStats() {
+    for (size_t i = 0; i < workerSlots_; ++i) {
+        workerStats_[i].busyNanos.store(0, std::memory_order_relaxed);
+    }
+    renderedSamples_.store(0, std::memory_order_relaxed);
+    renderStart_.store(steadyNanos(), std::memory_order_relaxed);
+}
+
+void Camera::addTileStats(const uint64_t samples, const int64_t nanos) {
+    const int worker = Scheduler::global().workerIndex();
+    auto &slot       = workerStats_[worker >= 0 ? static_cast<size_t>(worker) : workerSlots_ - 1];
+    slot.busyNanos.fetch_add(nanos, std::memory_order_relaxed);
+    renderedSamples_.fetch_add(samples, std::memory_order_relaxed);
+}
+
+RenderStats Camera::stats() const {
+    RenderStats stats;
+    stats.seconds   = static_cast<double>(steadyNanos() - renderStart_.load(std::memory_order_relaxed)) / 1e9;
+    stats.samples   = renderedSamples_.load(std::memory_order_relaxed);
+    stats.completed = completedSamples_.load(std::memory_order_relaxed);
+    stats.target    = targetSamples_.load(std::memory_order_relaxed);
+    stats.busy.resize(workerSlots_);
+    for (size_t i = 0; i < workerSlots_; ++i) {
+        stats.busy[i] = static_cast<double>(workerStats_[i].busyNanos.load(std::memory_order_relaxed)) / 1e9;
+    }
+    return stats;
+}
+
+size_t Camera::filmMemoryUsage() const {
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    size_t bytes        = pixels * (sizeof(Vec3) + sizeof(RGB));
+    // AOVs: albedo, normal, depth and squared luminance
+    bytes += pixels * (2 * sizeof(Vec3) + 2 * sizeof(Float));
+    // The heatmap buffer belongs to the render thread, so go by the setting instead of its size
+    if (traversalHeatmap_) bytes += pixels * sizeof(TraversalStats);
+    return bytes;
 }
 
 void StaticCamera::render(const Scene &scene) {
+    const auto renderStart           = std::chrono::steady_clock::now();
+    const ProfileReport profileStart = profileSnapshot();
+
     // Need to re-initialize everytime to reflect and potential changes in the scene
     init();
     stopRender_ = false;
     acc_.clear();
+    resetTiles(DEFAULT_TILE_SIZE);
+    resetRadianceCache(scene);
+    resetStats();
+
+    // A partial render accumulates a slice of each pixel's samples over a range of tiles, with the same seeds the
+    // full render would use, so the partial films add up to it
+    const bool partial    = isPartial();
+    const int totalSpp    = getSpp();
+    const int sampleBegin = std::clamp(sampleBegin_, 0, totalSpp);
+    const int sampleEnd   = sampleEnd_ < 0 ? totalSpp : std::clamp(sampleEnd_, sampleBegin, totalSpp);
+    const int tileCount   = static_cast<int>(tiles_.size());
+    const int tileBegin   = std::clamp(tileBegin_, 0, tileCount);
+    const int tileEnd     = tileEnd_ < 0 ? tileCount : std::clamp(tileEnd_, tileBegin, tileCount);
+    spp_                  = sampleEnd - sampleBegin;
+
+    // Latched so toggling the UI mid-render can't leave the AOVs half accumulated. The features come from the MIS
+    // integrator, the others don't report them. A partial film is only denoised once it has been merged.
+    bool denoiseEnabled = denoise_ && integrator_ == IntegratorType::MIS && !partial;
+    if (denoiseEnabled) aov_.clear();
+
+    const bool heatmap = traversalHeatmap_;
+    if (heatmap) {
+        traversal_.assign(static_cast<size_t>(width_) * height_, {});
+    } else {
+        traversal_.clear();
+    }
 
-    // Setup work queue and work orders
-    // We will create 32x32 tiles for each thread to work on
-    WorkQueue queue{};
-    queue.nextJobIndex = 0;
-    for (int r = 0; r < height_; r += 32) {
-        for (int c = 0; c < width_; c += 32) {
-            RayTraceJob job{};
-            job.startRow = r;
-            job.startCol = c;
-            job.endRow   = std::min(r + 32, height_);
-            job.endCol   = std::min(c + 32, width_);
-            queue.jobs.push_back(job);
+    // Snapshot updated tile by tile as tiles finish their passes, handed to the checkpoint thread periodically
+    const std::string checkpointPath = checkpointPath_;
+    std::unique_ptr<CheckpointWriter> checkpointWriter;
+    Checkpoint snapshot;
+    std::mutex snapshotMutex;
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    bool resumed        = false;
+    // Copy of the snapshot on its way to the writer, its buffers come back from the writer on submit. Only one
+    // thread fills it at a time, flagged under snapshotMutex.
+    Checkpoint outgoing;
+    bool copyingSnapshot = false;
+
+    fingerprint_ = renderFingerprint(scene);
+    if (!checkpointPath.empty()) {
+        resumed = resume_ && resumeFromCheckpoint(denoiseEnabled, snapshot);
+        if (!resumed) {
+            snapshot.reset(width_, height_, spp_, tileSize_, tiles_.size(), denoiseEnabled);
+            snapshot.maxSampleValue = maxSampleValue_;
+            snapshot.fingerprint    = fingerprint_;
         }
+        checkpointWriter = std::make_unique<CheckpointWriter>(checkpointPath);
     }
-
-    // Set up synchronization
-    currentSample_.store(0);
-    std::barrier endBarrier(threadCount_, [&]() noexcept {
-        currentSample_.fetch_add(samplesPerPass_);
-        if (currentSample_.load() >= spp_) {
-            stopRender_ = true;
+    // After a resume the tiling may have changed, but partial renders stay at the default
+    targetSamples_ = static_cast<int64_t>(partial ? tileEnd - tileBegin : static_cast<int>(tiles_.size())) * spp_;
+
+    // Copies the snapshot into outgoing a tile at a time, so other threads only ever wait for one tile's copy
+    auto copySnapshot = [&] {
+        {
+            std::lock_guard lock(snapshotMutex);
+            if (outgoing.color.size() != snapshot.color.size() || outgoing.tileSamples.size() != snapshot.tileSamples.size() ||
+                outgoing.hasAOVs() != snapshot.hasAOVs()) {
+                outgoing.reset(snapshot.width, snapshot.height, snapshot.spp, snapshot.tileSize, snapshot.tileSamples.size(), snapshot.hasAOVs());
+            }
+            outgoing.width          = snapshot.width;
+            outgoing.height         = snapshot.height;
+            outgoing.spp            = snapshot.spp;
+            outgoing.tileSize       = snapshot.tileSize;
+            outgoing.maxSampleValue = snapshot.maxSampleValue;
+            outgoing.fingerprint    = snapshot.fingerprint;
         }
-        queue.nextJobIndex = 0;
-    });
-
-    std::vector<std::thread> threads;
-    threads.reserve(threadCount_);
-
-    spp_ = getSpp();
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            const auto &job = tiles_[i];
+            std::lock_guard lock(snapshotMutex);
+            outgoing.copyTile(snapshot, i, job.startRow, job.startCol, job.endRow, job.endCol);
+        }
+    };
 
-    for (unsigned int t = 0; t < threadCount_; ++t) {
-        threads.emplace_back([this, &queue, &scene, &endBarrier] {
-            while (true) {
-                if (stopRender_) { break; }
-                const int sample = currentSample_.load();
+    // Renders one pass of a tile and returns the tile's new sample count
+    auto renderTile = [&](const uint32_t tileIndex) {
+        PROFILE_SCOPE("Render tile");
+        const auto &job = tiles_[tileIndex];
+        const int start = tileStates_[tileIndex].samples.load(std::memory_order_relaxed);
+        const int end   = jtx::min(start + samplesPerPass_, spp_);
+        beginTile(tileIndex);
 
-                while (true) {
-                    const auto jobIndex = queue.nextJobIndex.fetch_add(1, std::memory_order_relaxed);
-                    if (jobIndex >= queue.jobs.size()) { break; }
+        // Only stop between samples, so the tile's counter always matches what was accumulated
+        int sample = start;
+        for (; sample < end && !stopRender_; ++sample) {
+            for (auto row = job.startRow; row < job.endRow; ++row) {
+                for (auto col = job.startCol; col < job.endCol; ++col) {
+                    // Seed the PCG with row, column, and sample #
+                    const int index = sampleBegin + sample;
+                    RNG sampler(row, col, index + 1);
 
-                    const auto &job = queue.jobs[jobIndex];
+                    RayDifferential rd;
+                    const Ray r = getRay(col, row, index, sampler, &rd);
 
-                    for (auto currSample = sample; currSample < jtx::min(sample + samplesPerPass_, spp_); currSample++) {
-                        if (stopRender_) break;
-                        for (auto row = job.startRow; row < job.endRow; ++row) {
-                            if (stopRender_) break;
-                            for (auto col = job.startCol; col < job.endCol; ++col) {
-                                if (stopRender_) break;
+                    if (heatmap) Scene::setTraversalStats(&traversal_[row * width_ + col]);
 
-                                // Seed the PCG with row, column, and sample #
-                                RNG sampler(row, col, sample + 1);
+                    PathInfo info;
+                    Vec3 sampleColor = integrateSample(r, scene, sampler, rd, denoiseEnabled ? &info : nullptr);
 
-                                const Ray r = getRay(col, row, currSample, sampler);
+                    // Clamp the color
+                    sampleColor = clampSample(sampleColor);
 
-                                // Vec3 sampleColor = integrateBasic(r, scene, maxDepth_, sampler);
-                                // Vec3 sampleColor = integrate(r, scene, maxDepth_, sampler);
-                                Vec3 sampleColor = integrateMIS(r, scene, maxDepth_, false, sampler);
+                    if (denoiseEnabled) aov_.updatePixel(info.albedo, info.normal, info.depth, luminance(sampleColor), row, col);
 
-                                // Clamp the color
-                                if (sampleColor[0] > 1.0f) sampleColor[0] = 1.0f;
-                                if (sampleColor[1] > 1.0f) sampleColor[1] = 1.0f;
-                                if (sampleColor[2] > 1.0f) sampleColor[2] = 1.0f;
+                    acc_.updatePixel(sampleColor, row, col);
+                }
+            }
+            completeTileSample(tileIndex, sample + 1);
+        }
+        if (heatmap) Scene::setTraversalStats(nullptr);
+        endTile(tileIndex);
+
+        if (checkpointWriter && sample > start) {
+            bool due;
+            {
+                std::lock_guard lock(snapshotMutex);
+                snapshot.captureTile(acc_, denoiseEnabled ? &aov_ : nullptr, tileIndex, sample, job.startRow, job.startCol, job.endRow, job.endCol);
+
+                const auto now = std::chrono::steady_clock::now();
+                due            = !copyingSnapshot && std::chrono::duration<Float>(now - lastCheckpoint).count() >= checkpointInterval_;
+                if (due) {
+                    lastCheckpoint  = now;
+                    copyingSnapshot = true;
+                }
+            }
+            if (due) {
+                copySnapshot();
+                checkpointWriter->submit(std::move(outgoing));
+                std::lock_guard lock(snapshotMutex);
+                copyingSnapshot = false;
+            }
+        }
+        return sample;
+    };
+
+    // Unfinished tiles go into the queue in schedule order, then one long-running task per thread (this one
+    // included) pulls tiles until the queue runs dry. A tile is only ever held by one thread, so its pixels need
+    // no synchronization.
+    Scheduler &scheduler = Scheduler::global();
+    auto runTiles        = [&](const bool requeue, std::vector<int64_t> *costs) {
+        PROFILE_SCOPE(requeue ? "Render" : "Render first pass");
+        MPMCQueue<uint32_t> queue(tiles_.size());
+        for (const uint32_t i : tileSchedule_) {
+            const bool inRange = !partial || (static_cast<int>(i) >= tileBegin && static_cast<int>(i) < tileEnd);
+            if (inRange && tileStates_[i].samples.load(std::memory_order_relaxed) < spp_) queue.push(i);
+        }
 
-                                auto currAcc = acc_.updatePixel(sampleColor, row, col);
-                                img_.setPixel(currAcc / static_cast<float>(currSample + 1), row, col);
-                            }
-                        }
+        scheduler.parallelFor(scheduler.threadCount() + 1, [&](size_t) {
+            uint32_t tileIndex;
+            while (!stopRender_ && queue.pop(tileIndex)) {
+                const auto &job   = tiles_[tileIndex];
+                const int before  = tileStates_[tileIndex].samples.load(std::memory_order_relaxed);
+                const auto start  = std::chrono::steady_clock::now();
+                const int samples = renderTile(tileIndex);
+                const int64_t ns  = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                if (costs) (*costs)[tileIndex] = ns;
+                addTileStats(static_cast<uint64_t>(job.endRow - job.startRow) * (job.endCol - job.startCol) * (samples - before), ns);
+
+                if (requeue && samples < spp_) queue.push(tileIndex);
+            }
+        });
+    };
+
+    // On a fresh start, time the first pass at the default size and retile the rest of the render to suit. Tile
+    // ranges refer to the default tiling, so partial renders keep it.
+    const int firstPass = jtx::min(samplesPerPass_, spp_);
+    if (autoTileSize_ && !partial && !resumed && spp_ > firstPass) {
+        std::vector<int64_t> costs(tiles_.size());
+        runTiles(false, &costs);
+
+        if (!stopRender_) {
+            const int remainingPasses = (spp_ - firstPass + samplesPerPass_ - 1) / samplesPerPass_;
+            const int tileSize        = chooseTileSize(width_, height_, tileSize_, costs, scheduler.threadCount() + 1, remainingPasses);
+            if (tileSize != tileSize_) {
+                // Every tile has finished the first pass, so the new tiles all start from the same count
+                resetTiles(tileSize, firstPass);
+                if (checkpointWriter) {
+                    std::lock_guard lock(snapshotMutex);
+                    snapshot.reset(width_, height_, spp_, tileSize_, tiles_.size(), denoiseEnabled);
+                    for (size_t i = 0; i < tiles_.size(); ++i) {
+                        const auto &job = tiles_[i];
+                        snapshot.captureTile(acc_, denoiseEnabled ? &aov_ : nullptr, i, firstPass, job.startRow, job.startCol, job.endRow, job.endCol);
                     }
                 }
-                endBarrier.arrive_and_wait();
             }
-        });
+        }
     }
+    runTiles(true, nullptr);
 
-    for (auto &thread: threads) {
-        thread.join();
+    // Always leave the final state behind, whether the render finished or was terminated
+    if (checkpointWriter) {
+        checkpointWriter->submit(std::move(snapshot));
+        checkpointWriter->finish();
     }
+
+    // Only filter complete renders, an interrupted one keeps its noisy preview
+    const auto samples = tileSamples();
+    if (denoiseEnabled && std::ranges::all_of(samples, [this](const int n) { return n >= spp_; })) {
+        PROFILE_SCOPE("Denoise");
+        std::vector<Vec3> denoised;
+        denoise(acc_, aov_, spp_, denoiseSettings_, denoised);
+        presentImage(denoised);
+    }
+    if (heatmap) presentHeatmap();
+
+    // Counters are process-wide, so anything else rendering meanwhile (e.g. an interactive view) shows up too
+    profile_         = profileSnapshot() - profileStart;
+    profile_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+#ifdef ENABLE_PROFILING
+    printProfileReport(profile_, std::clog);
+#endif
+}
+
+bool StaticCamera::resumeFromCheckpoint(bool &denoiseEnabled, Checkpoint &snapshot) {
+    if (!loadCheckpoint(checkpointPath_, snapshot)) {
+        std::cerr << "No checkpoint to resume from, starting over: " << checkpointPath_ << std::endl;
+        return false;
+    }
+    // Continue with the tiling the checkpoint was written with, which partial renders can only do at the default
+    if (snapshot.tileSize != tileSize_ && !isPartial()) resetTiles(snapshot.tileSize);
+    if (snapshot.tileSize != tileSize_ || snapshot.width != width_ || snapshot.height != height_ || snapshot.spp != spp_ || snapshot.tileSamples.size() != tiles_.size() ||
+        snapshot.maxSampleValue != maxSampleValue_) {
+        std::cerr << "Checkpoint does not match the render settings, starting over: " << checkpointPath_ << std::endl;
+        return false;
+    }
+    if (snapshot.fingerprint != fingerprint_) {
+        std::cerr << "Checkpoint was rendered from a different scene or camera, starting over: " << checkpointPath_ << std::endl;
+        return false;
+    }
+
+    // The AOVs have to cover the same samples as the film, so without them the result can't be denoised
+    if (denoiseEnabled && !snapshot.hasAOVs()) {
+        std::cerr << "Checkpoint has no denoiser features, denoising disabled for this render" << std::endl;
+        denoiseEnabled = false;
+    }
+    // Stale AOVs would go out of sync with the film as the render continues
+    if (!denoiseEnabled) {
+        snapshot.albedo.clear();
+        snapshot.normal.clear();
+        snapshot.depth.clear();
+        snapshot.luminanceSq.clear();
+    }
+    snapshot.restore(acc_, denoiseEnabled ? &aov_ : nullptr);
+
+    // Restored tiles start out unresolved, so the display picks them up straight away
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        const int samples = snapshot.tileSamples[i];
+        tileStates_[i].samples.store(samples, std::memory_order_relaxed);
+        completedSamples_.fetch_add(samples, std::memory_order_relaxed);
+    }
+    return true;
 }
 
 DynamicCamera::DynamicCamera(
@@ -134,122 +604,241 @@ DynamicCamera::DynamicCamera(
         const int xPixelSamples,
         const int yPixelSamples,
         const int maxDepth,
-        const int samplesPerPass,
-        const int threadCount)
-    : Camera(width, height, std::move(cameraProperties), xPixelSamples, yPixelSamples, maxDepth, threadCount),
-      samplesPerPass_(samplesPerPass),
-      endBarrier_(threadCount_, [&]() noexcept {
-          currentSample_.fetch_add(samplesPerPass_);
-          // Reset the queue if we haven't reached the spp
-          if (currentSample_.load() < getSpp()) {
-            queue_.reset();
-          }
-      }) {
-    initWorkQueue();
-    startThreads();
-}
-
-void DynamicCamera::initWorkQueue() {
-    queue_.nextJobIndex = 0;
-    queue_.jobs.clear();
-    for (int r = 0; r < height_; r += 32) {
-        for (int c = 0; c < width_; c += 32) {
-            RayTraceJob job{};
-            job.startRow = r;
-            job.startCol = c;
-            job.endRow   = std::min(r + 32, height_);
-            job.endCol   = std::min(c + 32, width_);
-            queue_.jobs.push_back(job);
-        }
-    }
-}
+        const int samplesPerPass)
+    : Camera(width, height, std::move(cameraProperties), xPixelSamples, yPixelSamples, maxDepth),
+      samplesPerPass_(samplesPerPass) {}
 
-void DynamicCamera::startThreads() {
-    for (auto i = 0; i < threadCount_; ++i) {
-        threads_.emplace_back(&DynamicCamera::workerThread, this);
-    }
-}
+void DynamicCamera::stopRender() {
+    resetRender_ = true;
 
-void DynamicCamera::stopThreads() {
-    {
-        std::unique_lock<std::mutex> lock(queueMutex_);
-        stopThreads_ = true;
-    }
+    std::unique_lock lock(runningMutex_);
+    runningCondition_.wait(lock, [this] { return !running_; });
+}
 
-    queueCondition_.notify_all();
-    for (auto &thread: threads_) {
-        if (thread.joinable()) thread.join();
-    }
+size_t DynamicCamera::filmMemoryUsage() const {
+    size_t bytes = Camera::filmMemoryUsage();
+    bytes += surfaces_.capacity() * sizeof(Surface) + historyWeight_.capacity() * sizeof(Float);
+    bytes += previousColor_.capacity() * sizeof(Vec3) + previousWeight_.capacity() * sizeof(Float) + previousSurfaces_.capacity() * sizeof(Surface);
+    return bytes;
 }
 
 void DynamicCamera::resize(int w, int h) {
+    stopRender();
     Camera::resize(w, h);
-    initWorkQueue();
+
+    // The history can't be projected onto a different pixel grid
+    hasHistory_ = false;
+    surfaces_.clear();
 }
 
 void DynamicCamera::render(const Scene &scene) {
-    {
-        std::unique_lock<std::mutex> lock(queueMutex_);
-        stopThreads_ = false;
-        resetRender_ = true;
+    // Wind down the previous render before touching the buffers it writes to
+    stopRender();
+    saveHistory();
+
+    // Restarts after camera moves keep filling the same cache, only a different scene or path settings clear it
+    if (useRadianceCache_ && (radianceCacheStale_ || scene_ != &scene || radianceCacheDepth_ != maxDepth_ || radianceCacheClamp_ != maxSampleValue_)) {
+        resetRadianceCache(scene);
+        radianceCacheStale_ = false;
+        radianceCacheDepth_ = maxDepth_;
+        radianceCacheClamp_ = maxSampleValue_;
     }
 
     scene_ = &scene;
     init();
     acc_.clear();
-    img_.clear();
-    queue_.reset();
+    resetTiles(DEFAULT_TILE_SIZE);
+    resetStats();
     resetRender_ = false;
 
-    queueCondition_.notify_all();
-}
-
-void DynamicCamera::workerThread() {
-    while (true) {
-        // Wait for work
-        std::unique_lock lock(queueMutex_);
-        queueCondition_.wait(lock, [this] { return stopThreads_ || queue_.workAvailable(); });
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    recordSurfaces_     = reprojection_ && integrator_ == IntegratorType::MIS;
+    if (recordSurfaces_) {
+        surfaces_.assign(pixels, Surface{});
+        historyWeight_.assign(pixels, 0);
+    } else {
+        hasHistory_ = false;
+        surfaces_.clear();
+    }
 
-        lock.unlock();
-        if (stopThreads_) break;
+    // Keep showing the previous frame until the preview replaces it, instead of resolving the empty film
+    {
+        std::lock_guard lock(resolveMutex_);
+        pixelWeights_ = recordSurfaces_ ? historyWeight_.data() : nullptr;
+        for (size_t i = 0; i < tiles_.size(); ++i) {
+            tileStates_[i].resolvedVersion = 0;
+        }
+    }
 
-        const int sample = currentSample_.load();
+    {
+        std::lock_guard lock(runningMutex_);
+        running_ = true;
+    }
+    Scheduler::global().submit([this] {
+        renderPasses();
+        {
+            std::lock_guard lock(runningMutex_);
+            running_ = false;
+        }
+        runningCondition_.notify_all();
+    });
+}
 
-        while (true) {
-            if (resetRender_) break;
+void DynamicCamera::renderPasses() {
+    PROFILE_SCOPE("Render passes");
+    const int spp = getSpp();
 
-            const auto jobIndex = queue_.nextJobIndex.fetch_add(1, std::memory_order_relaxed);
-            if (jobIndex >= queue_.jobs.size()) { break; }
+    for (int level = previewLevels_; level > 0 && !resetRender_; --level) {
+        renderPreview(1 << level);
+    }
 
-            const auto &job = queue_.jobs[jobIndex];
+    MPMCQueue<uint32_t> queue(tiles_.size());
+    for (const uint32_t i : tileSchedule_) {
+        queue.push(i);
+    }
 
-            for (auto currSample = sample; currSample < jtx::min(sample + samplesPerPass_, getSpp()); currSample++) {
+    Scheduler &scheduler = Scheduler::global();
+    scheduler.parallelFor(scheduler.threadCount(), [&](size_t) {
+        uint32_t tileIndex;
+        while (!resetRender_ && queue.pop(tileIndex)) {
+            PROFILE_SCOPE("Render tile");
+            const auto passStart = std::chrono::steady_clock::now();
+            const auto &job      = tiles_[tileIndex];
+            const int start      = tileStates_[tileIndex].samples.load(std::memory_order_relaxed);
+            const int end        = jtx::min(start + samplesPerPass_, spp);
+            beginTile(tileIndex);
+
+            // A film that becomes the next history has to match its counters, so it only stops between samples
+            const bool stopMidSample = !recordSurfaces_;
+
+            int sample = start;
+            for (; sample < end; ++sample) {
                 if (resetRender_) break;
                 for (auto row = job.startRow; row < job.endRow; ++row) {
-                    if (resetRender_) break;
+                    if (stopMidSample && resetRender_) break;
                     for (auto col = job.startCol; col < job.endCol; ++col) {
-                        if (resetRender_) { break; }
+                        if (stopMidSample && resetRender_) { break; }
 
                         // Seed the PCG with row, column, and sample #
-                        RNG sampler(row, col, currSample + 1);
+                        RNG sampler(row, col, sample + 1);
 
-                        const Ray r = getRay(col, row, currSample, sampler);
+                        RayDifferential rd;
+                        const Ray r = getRay(col, row, sample, sampler, &rd);
 
-                        // Vec3 sampleColor = integrateBasic(r, *scene_, maxDepth_, sampler);
-                        // Color sampleColor = integrate(r, *job.scene, maxDepth_, sampler);
-                        Vec3 sampleColor = integrateMIS(r, *scene_, maxDepth_, false, sampler);
+                        const bool firstSample = recordSurfaces_ && sample == 0;
+                        PathInfo info;
+                        Vec3 sampleColor = integrateSample(r, *scene_, sampler, rd, firstSample ? &info : nullptr);
 
                         // Clamp the color
-                        if (sampleColor[0] > 1.0f) sampleColor[0] = 1.0f;
-                        if (sampleColor[1] > 1.0f) sampleColor[1] = 1.0f;
-                        if (sampleColor[2] > 1.0f) sampleColor[2] = 1.0f;
+                        sampleColor = clampSample(sampleColor);
 
-                        auto currAcc = acc_.updatePixel(sampleColor, row, col);
-                        img_.setPixel(currAcc / static_cast<float>(currSample + 1), row, col);
+                        if (firstSample) reprojectPixel(r, info.normal, info.depth, row, col);
+                        acc_.updatePixel(sampleColor, row, col);
                     }
                 }
+                // Otherwise a reset throws the film away, so a partial sample doesn't need to be accounted for
+                if (!stopMidSample || !resetRender_) completeTileSample(tileIndex, sample + 1);
+            }
+            endTile(tileIndex);
+            addTileStats(static_cast<uint64_t>(job.endRow - job.startRow) * (job.endCol - job.startCol) * (sample - start),
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - passStart).count());
+
+            if (sample < spp) queue.push(tileIndex);
+        }
+    });
+}
+
+void DynamicCamera::renderPreview(const int scale) {
+    PROFILE_SCOPE("Render preview");
+    Scheduler::global().parallelFor(tileSchedule_.size(), [&](const size_t i) {
+        if (resetRender_) return;
+        const uint32_t tileIndex = tileSchedule_[i];
+        const auto &job          = tiles_[tileIndex];
+        const int blocksX        = (job.endCol - job.startCol + scale - 1) / scale;
+        const int blocksY        = (job.endRow - job.startRow + scale - 1) / scale;
+
+        // Sample each block through its centre pixel
+        std::vector<Vec3> blocks(blocksX * blocksY);
+        for (int by = 0; by < blocksY; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                const uint32_t row = std::min(job.startRow + by * scale + scale / 2, job.endRow - 1);
+                const uint32_t col = std::min(job.startCol + bx * scale + scale / 2, job.endCol - 1);
+
+                // Sample 0 is never used by the full resolution passes, which seed with sample + 1
+                RNG sampler(row, col, 0);
+                RayDifferential rd;
+                const Ray r = getRay(col, row, 0, sampler);
+
+                blocks[by * blocksX + bx] = clampSample(integrateSample(r, *scene_, sampler, rd));
+            }
+        }
+        if (resetRender_) return;
+
+        std::lock_guard lock(resolveMutex_);
+        for (auto row = job.startRow; row < job.endRow; ++row) {
+            for (auto col = job.startCol; col < job.endCol; ++col) {
+                img_.setPixel(blocks[((row - job.startRow) / scale) * blocksX + (col - job.startCol) / scale], row, col);
             }
-        }// Render loop
-        endBarrier_.arrive_and_wait();
-    }// Thread loop
+        }
+        tileStates_[tileIndex].resolvedVersion = tileStates_[tileIndex].version.load(std::memory_order_acquire);
+    });
+}
+
+void DynamicCamera::saveHistory() {
+    // Only a render that recorded its surfaces at this size leaves a usable history
+    const size_t pixels = static_cast<size_t>(width_) * height_;
+    hasHistory_         = recordSurfaces_ && surfaces_.size() == pixels;
+    if (!hasHistory_) return;
+
+    previousColor_.resize(pixels);
+    previousWeight_.resize(pixels);
+    for (size_t i = 0; i < tiles_.size(); ++i) {
+        const auto &job     = tiles_[i];
+        const Float samples = static_cast<Float>(tileStates_[i].samples.load(std::memory_order_relaxed));
+        for (auto row = job.startRow; row < job.endRow; ++row) {
+            for (auto col = job.startCol; col < job.endCol; ++col) {
+                const size_t p     = static_cast<size_t>(row) * width_ + col;
+                const Float weight = samples + historyWeight_[p];
+                previousWeight_[p] = weight;
+                previousColor_[p]  = weight > 0 ? acc_.data()[p] * (1.0f / weight) : Vec3{0, 0, 0};
+            }
+        }
+    }
+    std::swap(previousSurfaces_, surfaces_);
+    previousView_ = {properties_.center, vp00_, du_, dv_, w_, properties_.focusDistance};
+}
+
+void DynamicCamera::reprojectPixel(const Ray &ray, const Vec3 &normal, const Float depth, const uint32_t row, const uint32_t col) {
+    const size_t p = static_cast<size_t>(row) * width_ + col;
+    if (depth <= 0) return;
+
+    Surface &surface = surfaces_[p];
+    surface.position = ray.origin + normalize(ray.dir) * depth;
+    surface.normal   = normal;
+    surface.depth    = depth;
+    if (!hasHistory_) return;
+
+    // Project the hit through the previous camera's center onto its viewport
+    const View &view   = previousView_;
+    const Vec3 toPoint = surface.position - view.center;
+    const Float along  = -dot(toPoint, view.w);
+    if (along <= 0) return;
+
+    const Vec3 offset = view.center + toPoint * (view.focusDistance / along) - view.vp00;
+    const Float colF  = std::floor(dot(offset, view.du) / dot(view.du, view.du));
+    const Float rowF  = std::floor(dot(offset, view.dv) / dot(view.dv, view.dv));
+    if (colF < 0 || rowF < 0 || colF >= static_cast<Float>(width_) || rowF >= static_cast<Float>(height_)) return;
+
+    // Reject disocclusions and different surfaces: the previous pixel has to have seen the same point, facing the
+    // same way. The distance tolerance grows with depth, like the pixel footprint.
+    const size_t q          = static_cast<size_t>(rowF) * width_ + static_cast<size_t>(colF);
+    const Surface &previous = previousSurfaces_[q];
+    const Float tolerance   = HISTORY_DISTANCE_TOLERANCE * toPoint.len();
+    if (previous.depth <= 0 || previousWeight_[q] <= 0) return;
+    if ((previous.position - surface.position).len() > tolerance) return;
+    if (dot(previous.normal, surface.normal) < HISTORY_MIN_NORMAL_COSINE) return;
+
+    const Float weight = jtx::min(previousWeight_[q], maxHistoryWeight_);
+    acc_.updatePixel(previousColor_[q] * weight, row, col);
+    historyWeight_[p] = weight;
 }
@@ -1,21 +1,56 @@
 #pragma once
 
+#include "checkpoint.hpp"
+#include "denoise.hpp"
 #include "image.hpp"
+#include "integrator.hpp"
+#include "profile.hpp"
+#include "radiance.hpp"
 #include "scene.hpp"
+#include "tiling.hpp"
 #include "util/rand.hpp"
 #include <atomic>
-#include <barrier>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
-#include <thread>
+#include <string>
 #include <utility>
+#include <vector>
+
+struct Frame;
+
+/**
+ * Tile of the image rendered by a single task
+ */
+struct RayTraceJob {
+    uint32_t startRow;
+    uint32_t startCol;
+    uint32_t endRow;
+    uint32_t endCol;
+};
+
+/**
+ * Running totals of a render, sampled by the UI to derive rates. All of them restart with each render.
+ */
+struct RenderStats {
+    // Wall time since the render started
+    double seconds = 0;
+    // Pixel samples traced
+    uint64_t samples = 0;
+    // Tile samples done and to do, the units of Camera::progress()
+    int64_t completed = 0;
+    int64_t target    = 0;
+    // Seconds each thread spent rendering tiles: the scheduler's workers, then one slot for the thread outside it
+    std::vector<double> busy;
+};
 
 /**
  * Camera base class
  *
  * Contains common functionality between the two camera classes StaticCamera and DynamicCamera.
  *
- * Rendering logic is implemented the respective methods of the derived classes due to differences
- * in thread management and synchronization overhead.
+ * Rendering logic is implemented the respective methods of the derived classes. Both split the image into
+ * tiles and run them as tasks on the global Scheduler.
  */
 class Camera {
 public:
@@ -29,8 +64,38 @@ public:
     int maxDepth_;
     CameraProperties properties_;
 
+    // Display image, resolved from the film on demand by resolveImage()
     RGB8Image img_;
-    std::atomic<int> currentSample_;
+
+    IntegratorType integrator_ = IntegratorType::MIS;
+
+    // Terminate paths into the radiance cache after the first diffuse bounce
+    bool useRadianceCache_ = false;
+
+    // Per-channel clamp applied to each sample before accumulation, INF keeps the full HDR range
+    Float maxSampleValue_ = 1.0f;
+
+    static constexpr int DEFAULT_TILE_SIZE = 32;
+
+    // Order tiles are rendered in, along a space-filling curve concurrently rendered tiles share cached geometry
+    TileOrder tileOrder_ = TileOrder::HILBERT;
+    // Time the first pass of a StaticCamera render and pick the tile size for the remaining passes from it
+    bool autoTileSize_ = true;
+
+    // Debug mode of StaticCamera: render as usual, but count the BVH nodes and triangles each pixel's rays visit.
+    // The finished image shows the work per sample as a heatmap, and EXR saves get the raw counts.
+    bool traversalHeatmap_ = false;
+
+    // Filter the finished image with the feature-guided denoiser
+    bool denoise_ = false;
+    DenoiseSettings denoiseSettings_;
+
+    // Periodically snapshot the film here so an interrupted render can be resumed, empty disables checkpointing
+    std::string checkpointPath_;
+    // Minimum number of seconds between checkpoints
+    Float checkpointInterval_ = 60.0f;
+    // Continue from checkpointPath_ instead of starting over, if it was written by the same scene and settings
+    bool resume_ = false;
 
     /**
      * Constructor
@@ -41,7 +106,7 @@ public:
      * @param yPixelSamples Number of sub-pixel samples in the y direction
      * @param maxDepth Maximum ray depth
      */
-    explicit Camera(const int width, const int height, CameraProperties cameraProperties, const int xPixelSamples, const int yPixelSamples, const int maxDepth, const int threadCount = 4)
+    explicit Camera(const int width, const int height, CameraProperties cameraProperties, const int xPixelSamples, const int yPixelSamples, const int maxDepth)
         : width_(width),
           height_(height),
           aspectRatio_(static_cast<Float>(width) / static_cast<Float>(height)),
@@ -51,13 +116,39 @@ public:
           properties_(std::move(cameraProperties)),
           img_(width, height),
           acc_(width, height),
-          threadCount_(threadCount) {}
+          aov_(width, height) {
+        resetTiles(DEFAULT_TILE_SIZE);
+        initStats();
+    }
 
     /**
-     * Saves the image buffer to a file (.png)
+     * Saves the render. Paths ending in .exr get the float film (accumulation / samples), anything else the
+     * 8-bit gamma corrected image as PNG.
      * @param path Path to save the image
+     * @return False if the file couldn't be written
      */
-    void save(const char *path) const { img_.save(path); }
+    bool save(const char *path);
+
+    /**
+     * Copies the render into a frame buffer to be written later, e.g. by a FrameWriter while the next frame renders.
+     * Takes the film for EXR paths and the resolved display image otherwise, like save().
+     * @param path Path the frame will be written to
+     * @param frame Receives the path and the image data, reusing its buffers
+     */
+    void captureFrame(const std::string &path, Frame &frame);
+
+    /**
+     * Copies the film and the tile sample counts into a snapshot, e.g. to write a partial render for merging
+     * @param film Receives the film, without AOVs
+     */
+    void exportFilm(Checkpoint &film) const;
+
+    /**
+     * Brings img_ up to date by resolving the tiles that have gained samples since the last call. Render threads
+     * only accumulate, so the 8-bit conversion happens here, at display rate instead of per sample.
+     * @return The display image
+     */
+    const RGB8Image &resolveImage();
 
     /**
      * Resizes the camera viewport
@@ -69,13 +160,26 @@ public:
     /**
      * Clears the image buffer
      */
-    void clear() { this->img_.clear(); }
+    void clear() {
+        std::lock_guard lock(resolveMutex_);
+        this->img_.clear();
+    }
 
     /**
      * Terminates the current render. Can take up to a frame to stop.
      */
     void terminateRender() { stopRender_ = true; }
 
+    /**
+     * Clamps a sample to maxSampleValue_ per channel
+     */
+    Vec3 clampSample(Vec3 color) const {
+        for (int c = 0; c < 3; ++c) {
+            if (color[c] > maxSampleValue_) color[c] = maxSampleValue_;
+        }
+        return color;
+    }
+
     /**
      * Calculates the number of samples per pixel
      * @return Number of samples per pixel
@@ -83,21 +187,80 @@ public:
     int getSpp() const { return xPixelSamples_ * yPixelSamples_; }
 
     /**
-     * Get the number of threads used for rendering
-     * @return Number of threads
+     * @return Number of tiles at DEFAULT_TILE_SIZE, the tiling partial render tile ranges refer to
      */
-    int getThreadCount() const {
-        return threadCount_;
+    int defaultTileCount() const {
+        return ((width_ + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE) * ((height_ + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE);
     }
 
+    /**
+     * @return Fraction of all tile samples of the current render that are done, from the per-tile counters
+     */
+    Float progress() const {
+        const auto total = static_cast<Float>(targetSamples_.load(std::memory_order_relaxed));
+        return total > 0 ? static_cast<Float>(completedSamples_.load(std::memory_order_relaxed)) / total : 0;
+    }
+
+    /**
+     * @return Samples completed by each tile, tiles are numbered row-major
+     */
+    std::vector<int> tileSamples() const;
+
+    /**
+     * @return Totals of the current or last render, safe to call while it runs
+     */
+    RenderStats stats() const;
+
+    /**
+     * @return Bytes used by the film, the display image and the per-pixel buffers that go with them
+     */
+    size_t filmMemoryUsage() const;
+
 protected:
     Vec3 vp00_;
     Vec3 du_, dv_;
     Vec3 u_, v_, w_;
     Vec3 defocus_u_, defocus_v_;
     AccumulationBuffer acc_;
-
-    int threadCount_;
+    AOVBuffer aov_;
+    RadianceCache radianceCache_;
+    // Traversal work of each pixel summed over its samples, empty unless the last render recorded a heatmap
+    std::vector<TraversalStats> traversal_;
+
+    struct TileState {
+        // Samples the tile has completed
+        std::atomic<int> samples = 0;
+        // Odd while a thread is writing to the tile, bumped on every change
+        std::atomic<uint32_t> version = 0;
+        // Version img_ was last resolved from, only touched under resolveMutex_
+        uint32_t resolvedVersion = UINT32_MAX;
+    };
+
+    // Tiles progress independently, each one tracks how many samples it has accumulated
+    int tileSize_ = DEFAULT_TILE_SIZE;
+    std::vector<RayTraceJob> tiles_;
+    // Row-major tile indices in tileOrder_
+    std::vector<uint32_t> tileSchedule_;
+    std::unique_ptr<TileState[]> tileStates_;
+    // Sum of all tile sample counts, for progress reporting
+    std::atomic<int64_t> completedSamples_ = 0;
+    // Tile samples the current render adds up to, every tile at getSpp() unless only part of the image is rendered
+    std::atomic<int64_t> targetSamples_ = 0;
+    // renderFingerprint of the last StaticCamera render, stamped on its checkpoints and exported films
+    uint64_t fingerprint_ = 0;
+    std::mutex resolveMutex_;
+    // Extra per-pixel weight of history seeded into acc_, added to the tile's sample count when resolving
+    const Float *pixelWeights_ = nullptr;
+
+    // Live totals for stats(), added to by the worker loops once per tile pass. Each thread has its own line.
+    struct alignas(64) WorkerStats {
+        std::atomic<int64_t> busyNanos = 0;
+    };
+    std::unique_ptr<WorkerStats[]> workerStats_;
+    size_t workerSlots_                    = 0;
+    std::atomic<uint64_t> renderedSamples_ = 0;
+    // Steady clock time the render started at, in nanoseconds
+    std::atomic<int64_t> renderStart_ = 0;
 
     /**
      * Samples a point on the Camera's defocus disc
@@ -116,15 +279,108 @@ protected:
      */
     void init();
 
+    /**
+     * Allocates a stats slot for every thread of the global scheduler plus one for the thread outside it
+     */
+    void initStats();
+
+    /**
+     * Zeroes the totals behind stats() and restarts its clock, called as a render starts
+     */
+    void resetStats();
+
+    /**
+     * Adds a finished tile pass to the calling thread's totals
+     * @param samples Pixel samples the pass traced
+     * @param nanos Time the pass took
+     */
+    void addTileStats(uint64_t samples, int64_t nanos);
+
+    /**
+     * Clears the radiance cache, sizing its cells to the scene
+     * @param scene Scene about to be rendered
+     */
+    void resetRadianceCache(const Scene &scene);
+
+    /**
+     * Hashes what a film depends on besides its size and sample counts: the scene's name and geometry, the camera
+     * properties, the integrator, the path depth and the sample clamp. Only a sample of the triangles is hashed, so
+     * it tells scenes apart rather than proving they are identical.
+     */
+    [[nodiscard]] uint64_t renderFingerprint(const Scene &scene) const;
+
+    /**
+     * @return Radiance cache to pass to the integrator, nullptr if disabled
+     */
+    RadianceCache *radianceCache() { return useRadianceCache_ ? &radianceCache_ : nullptr; }
+
+    /**
+     * Traces a camera ray with the selected integrator
+     * @param differential Ray differentials, only used by the MIS integrator
+     * @param info If set, receives the first hit. Only filled in by the MIS integrator.
+     * @return Radiance along the ray
+     */
+    Vec3 integrateSample(const Ray &ray, const Scene &scene, RNG &rng, const RayDifferential &differential, PathInfo *info = nullptr);
+
+    /**
+     * Splits the image into tiles, the unit of work handed to the scheduler, and resets their sample counters
+     * @param tileSize Tile edge length in pixels
+     * @param samples Sample count every tile starts with
+     */
+    void resetTiles(int tileSize, int samples = 0);
+
+    /**
+     * Marks a tile as being written to, resolveImage() skips it until endTile()
+     */
+    void beginTile(const size_t tile) {
+        auto &version = tileStates_[tile].version;
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endTile(const size_t tile) {
+        tileStates_[tile].version.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Records that a tile has finished one more sample
+     */
+    void completeTileSample(const size_t tile, const int samples) {
+        tileStates_[tile].samples.store(samples, std::memory_order_release);
+        completedSamples_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Replaces the display image with a final linear image (e.g. the denoised one), leaving every tile resolved
+     */
+    void presentImage(const std::vector<Vec3> &color);
+
+    /**
+     * Traversal work per sample of each pixel, indexed like the film
+     */
+    void traversalPerSample(std::vector<float> &nodes, std::vector<float> &triangles) const;
+
+    /**
+     * Replaces the display image with the traversal heatmap of nodes plus triangles per sample, scaled so the
+     * 99th percentile pixel is red and a few outliers don't wash out the rest
+     */
+    void presentHeatmap();
+
+    /**
+     * Writes the heatmap as RGB plus the raw per-sample counts as "nodes" and "triangles" channels
+     */
+    bool saveHeatmapEXR(const char *path);
+
     /**
      * Samples a ray from the camera
      * @param i Row
      * @param j Column
      * @param stratum Stratum (subpixel sample)
      * @param rng RNG instance
+     * @param differential If set, receives rays offset by one pixel in x and y, scaled down by the sample count
      * @return Ray
      */
-    Ray getRay(const uint32_t i, const uint32_t j, const uint32_t stratum, RNG &rng) const {
+    Ray getRay(const uint32_t i, const uint32_t j, const uint32_t stratum, RNG &rng, RayDifferential *differential = nullptr) const {
         const uint32_t x = stratum % xPixelSamples_;
         const uint32_t y = stratum / xPixelSamples_;
 
@@ -135,65 +391,80 @@ protected:
         const auto sample = vp00_ + (static_cast<float>(i) + offset.x) * du_ + (static_cast<float>(j) + offset.y) * dv_;
 
         auto origin = (properties_.defocusAngle <= 0) ? properties_.center : sampleDefocusDisc(rng);
-        return {origin, sample - origin, rng.sample<float>()};
+        const Ray ray{origin, sample - origin, rng.sample<float>()};
+
+        if (differential) {
+            differential->hasDifferentials = true;
+            differential->rxOrigin         = origin;
+            differential->ryOrigin         = origin;
+            differential->rxDir            = sample + du_ - origin;
+            differential->ryDir            = sample + dv_ - origin;
+
+            // Samples within a pixel cover a fraction of its footprint each
+            const Float spp = static_cast<Float>(xPixelSamples_ * yPixelSamples_);
+            differential->scale(ray, jtx::max(0.125f, 1.0f / std::sqrt(spp)));
+        }
+        return ray;
     }
 };
 
-/**
- * Job for a single ray tracing thread
- */
-struct RayTraceJob {
-    uint32_t startRow;
-    uint32_t startCol;
-    uint32_t endRow;
-    uint32_t endCol;
-};
-
-/**
- * Work queue for ray tracing threads
- */
-struct WorkQueue {
-    std::vector<RayTraceJob> jobs;
-    std::atomic<uint64_t> nextJobIndex;
-
-    /**
-     * Resets the work queue
-     */
-    void reset() { nextJobIndex = 0; }
-
-    /**
-     * Checks if there are more jobs to process
-     * @return True if there are more jobs to process, false o/w
-     */
-    bool workAvailable() const { return nextJobIndex < jobs.size(); }
-};
-
 /**
  * Static Camera
  *
- * This camera performs a render of a single frame per call to render().
+ * This camera performs a render of a single frame per call to render(), which blocks until the frame is done.
+ * The calling thread renders tiles alongside the scheduler's workers. Meant for single frame final renders.
  *
- * Uses threads and work queue allocated per call, with less synchronization overhead.
- * Meant for single frame final renders.
+ * There is no synchronization between passes: tiles wait in a lock-free queue, a thread takes the next one,
+ * renders samplesPerPass_ samples into it and puts it back at the end until it has all of its samples.
  */
 class StaticCamera : public Camera {
 public:
+    // Samples a tile renders each time it is taken from the queue
     int samplesPerPass_ = 1;
 
+    // Part of the render to do, so several processes can split one up and merge their films afterwards. Tiles are
+    // row-major indices at DEFAULT_TILE_SIZE, samples are indices into each pixel's getSpp() samples. Ranges
+    // exclude their end, -1 runs to the last one.
+    int tileBegin_   = 0;
+    int tileEnd_     = -1;
+    int sampleBegin_ = 0;
+    int sampleEnd_   = -1;
+
+    // Hot path counters of the last render, all zero unless built with ENABLE_PROFILING
+    ProfileReport profile_;
+
     using Camera::Camera;
 
     void render(const Scene &scene);
+
+    /**
+     * @return True if the tile or sample range leaves out part of the render
+     */
+    bool isPartial() const {
+        return tileBegin_ > 0 || (tileEnd_ >= 0 && tileEnd_ < defaultTileCount()) || sampleBegin_ > 0 || (sampleEnd_ >= 0 && sampleEnd_ < getSpp());
+    }
+
 private:
+    // Samples each tile accumulates this render
     int spp_;
+
+    /**
+     * Restores the film and the tile counters from checkpointPath_
+     * @param denoiseEnabled Cleared if the checkpoint has no AOVs to denoise with
+     * @param snapshot Receives the checkpoint, so later snapshots build on it
+     * @return False if there is no usable checkpoint
+     */
+    bool resumeFromCheckpoint(bool &denoiseEnabled, Checkpoint &snapshot);
 };
 
 /**
  * Dynamic Camera
  *
- * This camera has a persistent thread pool and work queue, with more synchronization overhead.
+ * Calling render() will start the render process on the scheduler and return immediately. Upon changing camera
+ * properties, the render will be terminated and restarted automatically.
  *
- * Calling render() will start the render process and return immediately. Upon changing camera properties,
- * the render will be terminated and restarted automatically.
+ * Every restart begins with a cascade of coarse previews, 1/8 -> 1/4 -> 1/2 resolution by default, each written
+ * straight to the display image so there is something to show within a frame of an interaction.
  */
 class DynamicCamera : public Camera {
 public:
@@ -204,10 +475,9 @@ public:
         int xPixelSamples,
         int yPixelSamples,
         int maxDepth,
-        int samplesPerPass = 1,
-        int threadCount = 4);
+        int samplesPerPass = 1);
 
-    ~DynamicCamera() { stopThreads(); }
+    ~DynamicCamera() { stopRender(); }
 
     /**
      * Resizes the camera viewport
@@ -222,44 +492,104 @@ public:
     void render(const Scene &scene);
 
     /**
-     * Terminates the rendering process
+     * Terminates the rendering process and waits for it to wind down
      */
-    void stopRender() { stopThreads(); }
+    void stopRender();
 
     int samplesPerPass_ = 1;
 
-private:
-    const Scene *scene_;
+    // Coarse levels rendered before the full resolution passes, each halving the block size of the previous one
+    int previewLevels_ = 3;
+
+    // Seed each restart with the previous film, reprojected onto the first hits of the new view
+    bool reprojection_ = false;
+    // Most samples the reprojected history counts for, so it fades out as new samples come in
+    Float maxHistoryWeight_ = 16.0f;
 
-    // WORK QUEUE
-    WorkQueue queue_;
-    std::mutex queueMutex_;
-    std::condition_variable queueCondition_;
+    /**
+     * Drops the reprojection history, for when the scene has changed underneath it
+     */
+    void discardHistory() { hasHistory_ = false; }
 
     /**
-     * Initializes the work queue
+     * Clears the radiance cache on the next render, for when the scene has changed underneath it. Camera moves
+     * keep the cache, the radiance it holds doesn't depend on the view.
      */
-    void initWorkQueue();
+    void discardRadianceCache() { radianceCacheStale_ = true; }
+
+    /**
+     * @return Bytes used by the film and the reprojection buffers, only to be called from the thread calling render()
+     */
+    size_t filmMemoryUsage() const;
+
+private:
+    const Scene *scene_ = nullptr;
 
-    // THREADS
-    std::vector<std::thread> threads_;
     std::atomic<bool> resetRender_ = false;
-    std::atomic<bool> stopThreads_ = false;
 
-    std::barrier<std::function<void()>> endBarrier_;
+    // Set when the radiance cache has to be cleared before it is used again
+    bool radianceCacheStale_ = true;
+    // Path settings the radiance cache was filled with, the cached radiance changes with them
+    int radianceCacheDepth_   = 0;
+    Float radianceCacheClamp_ = 0;
+
+    // Set while the pass loop is queued or running on the scheduler
+    bool running_ = false;
+    std::mutex runningMutex_;
+    std::condition_variable runningCondition_;
+
+    // First hit of a pixel's first sample, depth 0 if the path escaped
+    struct Surface {
+        Vec3 position;
+        Vec3 normal;
+        Float depth = 0;
+    };
+
+    // Camera frame a film was rendered from, enough to project world points back onto its pixels
+    struct View {
+        Vec3 center;
+        Vec3 vp00;
+        Vec3 du, dv;
+        Vec3 w;
+        Float focusDistance;
+    };
+
+    // Latched from reprojection_ when the render starts
+    bool recordSurfaces_ = false;
+    std::vector<Surface> surfaces_;
+    std::vector<Float> historyWeight_;
+
+    // Resolved film of the previous render and the surfaces it saw
+    bool hasHistory_ = false;
+    View previousView_{};
+    std::vector<Vec3> previousColor_;
+    std::vector<Float> previousWeight_;
+    std::vector<Surface> previousSurfaces_;
+
+    /**
+     * Renders tiles until all of them have reached the sample count or the render is reset. Runs as a scheduler
+     * task, tiles are handed out through a lock-free queue the same way as in StaticCamera.
+     */
+    void renderPasses();
 
     /**
-     * Initializes and starts the worker threads
+     * Traces one ray per scale x scale block of pixels and writes it to img_ over the whole block. Tiles are left
+     * marked as resolved, so the preview stays on screen until their first full resolution sample.
+     * @param scale Block edge length in pixels
      */
-    void startThreads();
+    void renderPreview(int scale);
 
     /**
-     * Gracefully stops the worker threads
+     * Moves the film of the finished or stopped render into the history, averaged per pixel
      */
-    void stopThreads();
+    void saveHistory();
 
     /**
-     * Worker thread function
+     * Records the first hit of a pixel's first sample. If the previous render saw the same surface at the point it
+     * projects to, its colour is added to the film as history.
+     * @param ray Camera ray of the sample
+     * @param normal Normal at the first hit
+     * @param depth Distance to the first hit, 0 if the path escaped
      */
-    void workerThread();
+    void reprojectPixel(const Ray &ray, const Vec3 &normal, Float depth, uint32_t row, uint32_t col);
 };
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "checkpoint.hpp"
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static constexpr char CHECKPOINT_MAGIC[4]   = {'J', 'T', 'X', 'C'};
+static constexpr uint32_t CHECKPOINT_VERSION = 4;
+
+// Set in CheckpointHeader::flags when the AOV buffers follow the colour data
+static constexpr uint32_t CHECKPOINT_HAS_AOVS = 1;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t width, height;
+    int32_t spp;
+    int32_t tileSize;
+    uint32_t tileCount;
+    uint32_t flags;
+    float maxSampleValue;
+    uint64_t fingerprint;
+};
+
+void Checkpoint::reset(const int w, const int h, const int totalSpp, const int tileEdge, const size_t tileCount, const bool withAOVs) {
+    const size_t n = static_cast<size_t>(w) * h;
+    width          = w;
+    height         = h;
+    spp            = totalSpp;
+    tileSize       = tileEdge;
+    tileSamples.assign(tileCount, 0);
+    color.assign(n, Vec3{0, 0, 0});
+
+    const size_t aovSize = withAOVs ? n : 0;
+    albedo.assign(aovSize, Vec3{0, 0, 0});
+    normal.assign(aovSize, Vec3{0, 0, 0});
+    depth.assign(aovSize, 0.0f);
+    luminanceSq.assign(aovSize, 0.0f);
+}
+
+void Checkpoint::captureTile(const AccumulationBuffer &acc, const AOVBuffer *aov, const size_t tile, const int samples,
+                             const int startRow, const int startCol, const int endRow, const int endCol) {
+    tileSamples[tile] = samples;
+    for (int row = startRow; row < endRow; ++row) {
+        const size_t begin = static_cast<size_t>(row) * width + startCol;
+        const size_t end   = static_cast<size_t>(row) * width + endCol;
+        std::copy(acc.data() + begin, acc.data() + end, color.begin() + begin);
+
+        if (aov && hasAOVs()) {
+            std::copy(aov->albedo() + begin, aov->albedo() + end, albedo.begin() + begin);
+            std::copy(aov->normal() + begin, aov->normal() + end, normal.begin() + begin);
+            std::copy(aov->depth() + begin, aov->depth() + end, depth.begin() + begin);
+            std::copy(aov->luminanceSq() + begin, aov->luminanceSq() + end, luminanceSq.begin() + begin);
+        }
+    }
+}
+
+void Checkpoint::copyTile(const Checkpoint &from, const size_t tile, const int startRow, const int startCol, const int endRow, const int endCol) {
+    tileSamples[tile] = from.tileSamples[tile];
+    for (int row = startRow; row < endRow; ++row) {
+        const size_t begin = static_cast<size_t>(row) * width + startCol;
+        const size_t end   = static_cast<size_t>(row) * width + endCol;
+        std::copy(from.color.begin() + begin, from.color.begin() + end, color.begin() + begin);
+
+        if (hasAOVs() && from.hasAOVs()) {
+            std::copy(from.albedo.begin() + begin, from.albedo.begin() + end, albedo.begin() + begin);
+            std::copy(from.normal.begin() + begin, from.normal.begin() + end, normal.begin() + begin);
+            std::copy(from.depth.begin() + begin, from.depth.begin() + end, depth.begin() + begin);
+            std::copy(from.luminanceSq.begin() + begin, from.luminanceSq.begin() + end, luminanceSq.begin() + begin);
+        }
+    }
+}
+
+void Checkpoint::restore(AccumulationBuffer &acc, AOVBuffer *aov) const {
+    std::ranges::copy(color, acc.data());
+
+    if (aov && hasAOVs()) {
+        std::ranges::copy(albedo, aov->albedo());
+        std::ranges::copy(normal, aov->normal());
+        std::ranges::copy(depth, aov->depth());
+        std::ranges::copy(luminanceSq, aov->luminanceSq());
+    }
+}
+
+template<typename T>
+static void writeVector(std::ofstream &out, const std::vector<T> &v) {
+    out.write(reinterpret_cast<const char *>(v.data()), static_cast<std::streamsize>(v.size() * sizeof(T)));
+}
+
+template<typename T>
+static bool readVector(std::ifstream &in, std::vector<T> &v, const size_t n) {
+    v.resize(n);
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(v.data()), static_cast<std::streamsize>(n * sizeof(T))));
+}
+
+bool saveCheckpoint(const std::string &path, const Checkpoint &checkpoint) {
+    PROFILE_SCOPE("Save checkpoint");
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version        = CHECKPOINT_VERSION;
+    header.width          = checkpoint.width;
+    header.height         = checkpoint.height;
+    header.spp            = checkpoint.spp;
+    header.tileSize       = checkpoint.tileSize;
+    header.tileCount      = static_cast<uint32_t>(checkpoint.tileSamples.size());
+    header.flags          = checkpoint.hasAOVs() ? CHECKPOINT_HAS_AOVS : 0;
+    header.maxSampleValue = checkpoint.maxSampleValue;
+    header.fingerprint    = checkpoint.fingerprint;
+
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary);
+        if (!out) return false;
+
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        writeVector(out, checkpoint.tileSamples);
+        writeVector(out, checkpoint.color);
+        if (checkpoint.hasAOVs()) {
+            writeVector(out, checkpoint.albedo);
+            writeVector(out, checkpoint.normal);
+            writeVector(out, checkpoint.depth);
+            writeVector(out, checkpoint.luminanceSq);
+        }
+
+        out.close();
+        if (!out) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+bool loadCheckpoint(const std::string &path, Checkpoint &checkpoint) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    CheckpointHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header.version != CHECKPOINT_VERSION) {
+        std::cerr << "Not a checkpoint file: " << path << std::endl;
+        return false;
+    }
+    // The sizes come straight from the file, so check they describe a film and that the data is actually there
+    // before allocating for them
+    const int64_t tilesX = header.tileSize > 0 ? (static_cast<int64_t>(header.width) + header.tileSize - 1) / header.tileSize : 0;
+    const int64_t tilesY = header.tileSize > 0 ? (static_cast<int64_t>(header.height) + header.tileSize - 1) / header.tileSize : 0;
+    if (header.width <= 0 || header.height <= 0 || header.tileSize <= 0 || header.spp <= 0 || header.tileCount != tilesX * tilesY) {
+        std::cerr << "Checkpoint header is inconsistent: " << path << std::endl;
+        return false;
+    }
+
+    const size_t n          = static_cast<size_t>(header.width) * header.height;
+    const size_t tileBytes  = static_cast<size_t>(header.tileCount) * sizeof(int);
+    const size_t pixelBytes = sizeof(Vec3) + (header.flags & CHECKPOINT_HAS_AOVS ? 2 * sizeof(Vec3) + 2 * sizeof(Float) : 0);
+    std::error_code ec;
+    const uintmax_t fileSize = std::filesystem::file_size(path, ec);
+    if (ec || fileSize < sizeof(header) + tileBytes || (fileSize - sizeof(header) - tileBytes) / pixelBytes < n) {
+        std::cerr << "Checkpoint is truncated: " << path << std::endl;
+        return false;
+    }
+
+    checkpoint.width          = header.width;
+    checkpoint.height         = header.height;
+    checkpoint.spp            = header.spp;
+    checkpoint.tileSize       = header.tileSize;
+    checkpoint.maxSampleValue = header.maxSampleValue;
+    checkpoint.fingerprint    = header.fingerprint;
+
+    if (!readVector(in, checkpoint.tileSamples, header.tileCount) || !readVector(in, checkpoint.color, n)) return false;
+
+    if (header.flags & CHECKPOINT_HAS_AOVS) {
+        if (!readVector(in, checkpoint.albedo, n) || !readVector(in, checkpoint.normal, n) ||
+            !readVector(in, checkpoint.depth, n) || !readVector(in, checkpoint.luminanceSq, n)) {
+            return false;
+        }
+    } else {
+        checkpoint.albedo.clear();
+        checkpoint.normal.clear();
+        checkpoint.depth.clear();
+        checkpoint.luminanceSq.clear();
+    }
+    return true;
+}
+
+bool mergeFilm(Checkpoint &merged, const Checkpoint &partial) {
+    if (merged.width == 0) {
+        merged.reset(partial.width, partial.height, partial.spp, partial.tileSize, partial.tileSamples.size(), false);
+        merged.maxSampleValue = partial.maxSampleValue;
+        merged.fingerprint    = partial.fingerprint;
+    }
+
+    if (partial.width != merged.width || partial.height != merged.height || partial.tileSize != merged.tileSize || partial.spp != merged.spp ||
+        partial.tileSamples.size() != merged.tileSamples.size() || partial.maxSampleValue != merged.maxSampleValue ||
+        partial.fingerprint != merged.fingerprint) {
+        return false;
+    }
+
+    for (size_t i = 0; i < merged.tileSamples.size(); ++i) merged.tileSamples[i] += partial.tileSamples[i];
+    for (size_t i = 0; i < merged.color.size(); ++i) merged.color[i] += partial.color[i];
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path)
+    : path_(std::move(path)) {
+    thread_ = std::thread(&CheckpointWriter::run, this);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    finish();
+}
+
+void CheckpointWriter::submit(const Checkpoint &checkpoint) {
+    {
+        std::lock_guard lock(mutex_);
+        pending_    = checkpoint;
+        hasPending_ = true;
+    }
+    condition_.notify_one();
+}
+
+void CheckpointWriter::submit(Checkpoint &&checkpoint) {
+    {
+        std::lock_guard lock(mutex_);
+        std::swap(pending_, checkpoint);
+        hasPending_ = true;
+    }
+    condition_.notify_one();
+}
+
+void CheckpointWriter::finish() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_one();
+    if (thread_.joinable()) thread_.join();
+}
+
+void CheckpointWriter::run() {
+    Checkpoint current;
+    while (true) {
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return hasPending_ || stop_; });
+            if (!hasPending_) return;
+
+            // Swap so the render threads can submit the next snapshot while this one is written
+            std::swap(current, pending_);
+            hasPending_ = false;
+        }
+
+        if (!saveCheckpoint(path_, current)) {
+            std::cerr << "Failed to write checkpoint: " << path_ << std::endl;
+        }
+    }
+}
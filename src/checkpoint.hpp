@@ -0,0 +1,119 @@
+#pragma once
+
+#include "image.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Snapshot of a render
+ *
+ * Tiles progress independently, so the snapshot records how many samples each tile has completed. It is built up
+ * one tile at a time, whenever a tile finishes a pass, so every tile in it is consistent with its sample count.
+ *
+ * The samplers are seeded from (row, column, sample), so the sample counters are all the sampler state needed to
+ * continue a render exactly where it left off.
+ */
+struct Checkpoint {
+    int width    = 0;
+    int height   = 0;
+    int spp      = 0;
+    int tileSize = 0;
+    // Per-channel sample clamp the film was accumulated with, films at different clamps don't add up
+    Float maxSampleValue = INF;
+    // Hash of the scene and the camera settings the film was rendered with, see Camera::renderFingerprint
+    uint64_t fingerprint = 0;
+    // Samples completed per tile, tiles are numbered row-major
+    std::vector<int> tileSamples;
+    std::vector<Vec3> color;
+
+    // Denoiser AOVs, empty unless the render accumulates them
+    std::vector<Vec3> albedo;
+    std::vector<Vec3> normal;
+    std::vector<Float> depth;
+    std::vector<Float> luminanceSq;
+
+    [[nodiscard]] bool hasAOVs() const { return !albedo.empty(); }
+
+    /**
+     * Sets up an empty snapshot, with every tile at zero samples. The sample clamp and fingerprint are left as they are.
+     */
+    void reset(int w, int h, int totalSpp, int tileEdge, size_t tileCount, bool withAOVs);
+
+    /**
+     * Copies one tile of the film (and optionally the AOVs) into the snapshot
+     * @param tile Row-major tile index
+     * @param samples Samples the tile has completed
+     */
+    void captureTile(const AccumulationBuffer &acc, const AOVBuffer *aov, size_t tile, int samples, int startRow, int startCol, int endRow, int endCol);
+
+    /**
+     * Copies one tile and its sample count from another snapshot of the same size and tiling
+     */
+    void copyTile(const Checkpoint &from, size_t tile, int startRow, int startCol, int endRow, int endCol);
+
+    /**
+     * Copies the snapshot back into the film (and AOVs, if both have them)
+     */
+    void restore(AccumulationBuffer &acc, AOVBuffer *aov) const;
+};
+
+/**
+ * Writes a checkpoint to a compact binary file. The file is written next to the target and renamed into place,
+ * so a crash mid-write leaves the previous checkpoint intact.
+ */
+bool saveCheckpoint(const std::string &path, const Checkpoint &checkpoint);
+
+bool loadCheckpoint(const std::string &path, Checkpoint &checkpoint);
+
+/**
+ * Adds a partial film (see StaticCamera's tile and sample ranges) into merged. Films and tile sample counts are
+ * both sums, so tiles rendered by several partials end up weighted by how many samples each contributed. The AOVs
+ * are dropped, they can't be denoised consistently across partials.
+ * @param merged Film to add to, an empty one (width 0) takes on the partial's size and tiling
+ * @return False if the films differ in size, tiling, sample count, sample clamp or fingerprint
+ */
+bool mergeFilm(Checkpoint &merged, const Checkpoint &partial);
+
+/**
+ * Background checkpoint writer
+ *
+ * Render threads hand over snapshots with submit() and carry on; the file I/O happens on a dedicated thread.
+ * Only the latest snapshot matters, so one that arrives while another is still pending replaces it.
+ */
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::string path);
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter &)            = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    void submit(const Checkpoint &checkpoint);
+
+    /**
+     * Hands over a snapshot without copying it
+     * @param checkpoint Left holding the buffers of an earlier snapshot, to be reused for the next one
+     */
+    void submit(Checkpoint &&checkpoint);
+
+    /**
+     * Writes any pending snapshot and stops the writer thread
+     */
+    void finish();
+
+private:
+    std::string path_;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+
+    Checkpoint pending_;
+    bool hasPending_ = false;
+    bool stop_       = false;
+
+    void run();
+};
@@ -0,0 +1,157 @@
+#include "denoise.hpp"
+#include "scheduler.hpp"
+
+#include <cmath>
+
+static constexpr int TILE_SIZE = 32;
+
+// Albedo below this is treated as black, so dark texels don't blow up the demodulated irradiance
+static constexpr Float MIN_ALBEDO = 0.01f;
+
+// 1D B3-spline kernel, applied separably as a 5x5 footprint
+static constexpr Float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+struct Guide {
+    Vec3 albedo;
+    Vec3 normal;
+    Float depth;
+    // Screen-space depth gradient, makes the depth weight independent of the scene scale
+    Float depthGradient;
+};
+
+struct FilterTile {
+    int startRow, startCol;
+    int endRow, endCol;
+};
+
+struct FilterPixel {
+    Vec3 irradiance;
+    Float variance;
+};
+
+static void filterPass(const std::vector<FilterPixel> &src, std::vector<FilterPixel> &dst, const std::vector<Guide> &guide,
+                       const int width, const int height, const int step, const DenoiseSettings &settings,
+                       const int startRow, const int startCol, const int endRow, const int endCol) {
+    for (int row = startRow; row < endRow; ++row) {
+        for (int col = startCol; col < endCol; ++col) {
+            const int i     = row * width + col;
+            const Guide &gp = guide[i];
+            const auto &p   = src[i];
+
+            // Background pixels have nothing to filter against
+            if (gp.depth <= 0) {
+                dst[i] = p;
+                continue;
+            }
+
+            const Float lumP     = luminance(p.irradiance);
+            const Float lumScale = settings.sigmaLuminance * jtx::sqrt(jtx::max(p.variance, 0.0f)) + 1e-6f;
+
+            Vec3 sum        = p.irradiance * (KERNEL[0] * KERNEL[0]);
+            Float varSum    = p.variance * (KERNEL[0] * KERNEL[0]) * (KERNEL[0] * KERNEL[0]);
+            Float weightSum = KERNEL[0] * KERNEL[0];
+
+            for (int dy = -2; dy <= 2; ++dy) {
+                const int y = row + dy * step;
+                if (y < 0 || y >= height) continue;
+
+                for (int dx = -2; dx <= 2; ++dx) {
+                    if (dx == 0 && dy == 0) continue;
+                    const int x = col + dx * step;
+                    if (x < 0 || x >= width) continue;
+
+                    const int j     = y * width + x;
+                    const Guide &gq = guide[j];
+                    if (gq.depth <= 0) continue;
+
+                    const auto &q = src[j];
+
+                    const Float wNormal = jtx::pow(jtx::max(0.0f, jtx::dot(gp.normal, gq.normal)), settings.sigmaNormal);
+                    const Float dist    = jtx::sqrt(static_cast<Float>(dx * dx + dy * dy)) * static_cast<Float>(step);
+                    const Float wDepth  = jtx::abs(gp.depth - gq.depth) / (settings.sigmaDepth * gp.depthGradient * dist + 1e-6f);
+                    const Float wLum    = jtx::abs(lumP - luminance(q.irradiance)) / lumScale;
+
+                    const Float h = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)];
+                    const Float w = h * wNormal * std::exp(-wDepth - wLum);
+
+                    sum += q.irradiance * w;
+                    varSum += q.variance * w * w;
+                    weightSum += w;
+                }
+            }
+
+            dst[i] = {sum / weightSum, varSum / (weightSum * weightSum)};
+        }
+    }
+}
+
+void denoise(const AccumulationBuffer &color, const AOVBuffer &aov, const int samples, const DenoiseSettings &settings, std::vector<Vec3> &out) {
+    const int width  = color.w_;
+    const int height = color.h_;
+    const int n      = width * height;
+    const Float inv  = 1.0f / static_cast<Float>(jtx::max(samples, 1));
+
+    std::vector<Guide> guide(n);
+    std::vector<FilterPixel> ping(n), pong(n);
+
+    // Average the accumulated buffers and demodulate the albedo
+    for (int i = 0; i < n; ++i) {
+        Guide &g = guide[i];
+        g.albedo = aov.albedo()[i] * inv;
+        g.depth  = aov.depth()[i] * inv;
+
+        const Vec3 normal = aov.normal()[i] * inv;
+        g.normal          = normal.lenSqr() > 0 ? normalize(normal) : normal;
+
+        const Vec3 mean = color.data()[i] * inv;
+        Vec3 irradiance;
+        for (int c = 0; c < 3; ++c) {
+            irradiance[c] = g.albedo[c] > MIN_ALBEDO ? mean[c] / g.albedo[c] : mean[c];
+        }
+
+        // Variance of the mean luminance, taken from the colour samples before demodulation
+        const Float lum      = luminance(mean);
+        const Float variance = jtx::max(0.0f, aov.luminanceSq()[i] * inv - lum * lum) * inv;
+        const Float lumAlb   = jtx::max(luminance(g.albedo), MIN_ALBEDO);
+        ping[i]              = {irradiance, variance / (lumAlb * lumAlb)};
+    }
+
+    for (int row = 0; row < height; ++row) {
+        for (int col = 0; col < width; ++col) {
+            const int i            = row * width + col;
+            const Float dzdx       = col + 1 < width ? jtx::abs(guide[i + 1].depth - guide[i].depth) : 0;
+            const Float dzdy       = row + 1 < height ? jtx::abs(guide[i + width].depth - guide[i].depth) : 0;
+            guide[i].depthGradient = jtx::max(jtx::max(dzdx, dzdy), 1e-4f * guide[i].depth);
+        }
+    }
+
+    std::vector<FilterTile> tiles;
+    for (int r = 0; r < height; r += TILE_SIZE) {
+        for (int c = 0; c < width; c += TILE_SIZE) {
+            tiles.push_back({r, c, jtx::min(r + TILE_SIZE, height), jtx::min(c + TILE_SIZE, width)});
+        }
+    }
+
+    // One pass per iteration, ping-ponging between the two buffers
+    std::vector<FilterPixel> *src = &ping;
+    std::vector<FilterPixel> *dst = &pong;
+
+    for (int iteration = 0; iteration < settings.iterations; ++iteration) {
+        const int step = 1 << iteration;
+        Scheduler::global().parallelFor(tiles.size(), [&](const size_t tileIndex) {
+            const auto &tile = tiles[tileIndex];
+            filterPass(*src, *dst, guide, width, height, step, settings, tile.startRow, tile.startCol, tile.endRow, tile.endCol);
+        });
+        std::swap(src, dst);
+    }
+
+    // Re-modulate
+    out.resize(n);
+    for (int i = 0; i < n; ++i) {
+        const Vec3 &albedo = guide[i].albedo;
+        const Vec3 &e      = (*src)[i].irradiance;
+        for (int c = 0; c < 3; ++c) {
+            out[i][c] = albedo[c] > MIN_ALBEDO ? e[c] * albedo[c] : e[c];
+        }
+    }
+}
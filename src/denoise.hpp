@@ -0,0 +1,31 @@
+#pragma once
+
+#include "image.hpp"
+
+#include <vector>
+
+struct DenoiseSettings {
+    // Number of à-trous passes, the footprint doubles with each one (5 passes cover 63x63 pixels)
+    int iterations = 5;
+    // Edge-stopping strengths, larger values blur less across edges
+    Float sigmaLuminance = 4.0f;
+    Float sigmaNormal    = 128.0f;
+    Float sigmaDepth     = 1.0f;
+};
+
+/**
+ * Feature-guided denoiser
+ *
+ * Spatial part of SVGF: an edge-avoiding à-trous wavelet filter over demodulated irradiance (colour divided by
+ * first-hit albedo), with edge-stopping weights from normals, depth and the per-pixel luminance variance.
+ * Texture detail is restored by re-modulating with the albedo at the end.
+ *
+ * See: https://research.nvidia.com/publication/2017-07_spatiotemporal-variance-guided-filtering-real-time-reconstruction-path-traced
+ *
+ * @param color Accumulated colour
+ * @param aov Accumulated first-hit features
+ * @param samples Number of samples accumulated per pixel
+ * @param settings Filter settings, tiles are filtered in parallel on the global Scheduler
+ * @param out Denoised colour, resized to the image
+ */
+void denoise(const AccumulationBuffer &color, const AOVBuffer &aov, int samples, const DenoiseSettings &settings, std::vector<Vec3> &out);
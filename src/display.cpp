@@ -4,6 +4,7 @@
 #include "camera.hpp"
 
 #include <SDL.h>
+#include <algorithm>
 #include <future>
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
@@ -145,12 +146,13 @@ void setUiTheme() {
     style.Colors[ImGuiCol_ModalWindowDimBg] = ImVec4(0.800000011920929f, 0.800000011920929f, 0.800000011920929f, 0.3499999940395355f);
 }
 
-Display::Display(const int width, const int height, StaticCamera *camera)
+Display::Display(const int width, const int height, StaticCamera *camera, DynamicCamera *dynamicCamera)
     : width_(0),
       height_(0),
       logicalWidth_(width),
       logicalHeight_(height),
       camera_(camera),
+      dynamicCamera_(dynamicCamera),
       renderWidth_(0),
       scaleX_(0),
       scaleY_(0),
@@ -185,7 +187,7 @@ bool Display::init() {
 
     saveRenderDialog_ = ImGui::FileBrowser(ImGuiFileBrowserFlags_CreateNewDir | ImGuiFileBrowserFlags_EditPathString | ImGuiFileBrowserFlags_EnterNewFilename);
     saveRenderDialog_.SetTitle("Save render");
-    saveRenderDialog_.SetTypeFilters({".png"});
+    saveRenderDialog_.SetTypeFilters({".png", ".exr"});
 
     return true;
 }
@@ -237,6 +239,22 @@ void Display::renderMenuBar(bool inputDisabled) {
             if (inputDisabled) {
                 ImGui::EndDisabled();
             }
+            if (isRendering_) {
+                ImGui::BeginDisabled();
+            }
+            if (ImGui::MenuItem("Interactive", nullptr, &interactiveMode_)) {
+                if (interactiveMode_) {
+                    // The scene may have been edited since the last interactive session
+                    dynamicCamera_->discardHistory();
+                    dynamicCamera_->discardRadianceCache();
+                    resetRender_ = true;
+                } else {
+                    dynamicCamera_->stopRender();
+                }
+            }
+            if (isRendering_) {
+                ImGui::EndDisabled();
+            }
             if (ImGui::MenuItem("Cancel")) {
                 camera_->terminateRender();
             }
@@ -256,7 +274,7 @@ void Display::renderMenuBar(bool inputDisabled) {
         }
 
         if (isRendering_) {
-            const float progress          = static_cast<float>(camera_->currentSample_.load()) / static_cast<float>(camera_->getSpp());
+            const float progress          = camera_->progress();
             const float menuBarHeight     = ImGui::GetFrameHeight();
             const float progressBarHeight = menuBarHeight * 0.6f;
             // Set progress bar width proportional to the sidebar width minus 10px padding on each side
@@ -286,7 +304,129 @@ void Display::renderMenuBar(bool inputDisabled) {
     }
 }
 
-void Display::renderConfig() {
+// Seconds of render time between the samples the live rates are taken from
+static constexpr double STATS_INTERVAL = 0.5;
+
+static std::string formatBytes(const size_t bytes) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f MB", static_cast<double>(bytes) / (1024.0 * 1024.0));
+    return text;
+}
+
+static std::string formatSeconds(const double seconds) {
+    char text[32];
+    const int whole = static_cast<int>(seconds);
+    if (whole >= 3600) {
+        snprintf(text, sizeof(text), "%dh %02dm", whole / 3600, whole / 60 % 60);
+    } else if (whole >= 60) {
+        snprintf(text, sizeof(text), "%dm %02ds", whole / 60, whole % 60);
+    } else {
+        snprintf(text, sizeof(text), "%.1fs", seconds);
+    }
+    return text;
+}
+
+void Display::renderStats() {
+    if (!ImGui::CollapsingHeader("Stats", ImGuiTreeNodeFlags_DefaultOpen)) return;
+
+    const Camera *view      = interactiveMode_ ? static_cast<const Camera *>(dynamicCamera_) : camera_;
+    const bool active       = isRendering_ || interactiveMode_;
+    const RenderStats stats = view->stats();
+    // Process-wide and zero without ENABLE_PROFILING, the cameras only count samples
+    const uint64_t rays = profileSnapshot().rays();
+
+    // A restarted render starts its totals over, so take a new baseline instead of reporting a negative rate
+    LiveStats &live = liveStats_;
+    if (live.camera != view || stats.seconds < live.last.seconds || stats.samples < live.last.samples) {
+        live = LiveStats{view, stats, rays};
+        live.utilization.assign(stats.busy.size(), 0.0f);
+    } else if (const double dt = stats.seconds - live.last.seconds; dt >= STATS_INTERVAL) {
+        live.samplesPerSecond     = static_cast<double>(stats.samples - live.last.samples) / dt;
+        live.raysPerSecond        = static_cast<double>(rays - live.lastRays) / dt;
+        live.tileSamplesPerSecond = static_cast<double>(stats.completed - live.last.completed) / dt;
+        for (size_t i = 0; i < stats.busy.size(); ++i) {
+            live.utilization[i] = std::clamp(static_cast<float>((stats.busy[i] - live.last.busy[i]) / dt), 0.0f, 1.0f);
+        }
+        live.last     = stats;
+        live.lastRays = rays;
+    }
+
+    if (ImGui::BeginTable("StatsTable", 2, ImGuiTableFlags_SizingStretchSame)) {
+        ImGui::TableSetupColumn("Stat", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+        ImGui::TableSetupColumn("Value", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+
+        if (active) {
+#ifdef ENABLE_PROFILING
+            tableRow("Mrays/s");
+            ImGui::Text("%.2f", live.raysPerSecond / 1e6);
+#endif
+            tableRow("Msamples/s");
+            ImGui::Text("%.2f", live.samplesPerSecond / 1e6);
+
+            // One samplesPerPass_ over the whole image at the current rate
+            const int samplesPerPass = interactiveMode_ ? dynamicCamera_->samplesPerPass_ : camera_->samplesPerPass_;
+            const double passSamples = static_cast<double>(view->width_) * view->height_ * samplesPerPass;
+            tableRow("Pass Time");
+            ImGui::Text("%s", live.samplesPerSecond > 0 ? formatSeconds(passSamples / live.samplesPerSecond).c_str() : "-");
+
+            tableRow("Samples");
+            ImGui::Text("%.1f / %d spp", view->progress() * static_cast<Float>(view->getSpp()), view->getSpp());
+
+            tableRow("Elapsed");
+            ImGui::Text("%s", formatSeconds(stats.seconds).c_str());
+
+            const int64_t remaining = stats.target - stats.completed;
+            tableRow("Remaining");
+            if (remaining <= 0) {
+                ImGui::Text("Done");
+            } else {
+                ImGui::Text("%s", live.tileSamplesPerSecond > 0 ? formatSeconds(static_cast<double>(remaining) / live.tileSamplesPerSecond).c_str() : "-");
+            }
+        }
+
+        if (scene_) {
+            tableRow("BVH Memory");
+            ImGui::Text("%s", formatBytes(scene_->bvhMemoryUsage()).c_str());
+            tableRow("Texture Memory");
+            ImGui::Text("%s", formatBytes(scene_->textureMemoryUsage()).c_str());
+
+            if (scene_->textureCache) {
+                const auto cache   = scene_->textureCache->stats();
+                const auto lookups  = cache.hits + cache.misses;
+                tableRow("Texture Tiles");
+                ImGui::Text("%.1f%% hits", lookups > 0 ? 100.0 * static_cast<double>(cache.hits) / static_cast<double>(lookups) : 0.0);
+                tableRow("Tile Misses");
+                ImGui::Text("%llu", static_cast<unsigned long long>(cache.misses));
+                tableRow("Tile Evictions");
+                ImGui::Text("%llu", static_cast<unsigned long long>(cache.evictions));
+            }
+        }
+        tableRow("Film Memory");
+        ImGui::Text("%s", formatBytes(interactiveMode_ ? dynamicCamera_->filmMemoryUsage() : camera_->filmMemoryUsage()).c_str());
+
+        ImGui::EndTable();
+    }
+
+    // The last slot is the thread outside the scheduler, which only renders tiles in StaticCamera renders
+    const size_t threads = interactiveMode_ && !live.utilization.empty() ? live.utilization.size() - 1 : live.utilization.size();
+    if (active && threads > 0) {
+        float average = 0;
+        for (size_t i = 0; i < threads; ++i) average += live.utilization[i];
+        average /= static_cast<float>(threads);
+
+        char overlay[32];
+        snprintf(overlay, sizeof(overlay), "%.0f%% busy", average * 100.0f);
+        ImGui::SeparatorText("Thread Utilization");
+        ImGui::PlotHistogram("##Utilization", live.utilization.data(), static_cast<int>(threads), 0, overlay, 0.0f, 1.0f, ImVec2(ImGui::GetContentRegionAvail().x, 60));
+    }
+}
+
+void Display::renderConfig(const bool inputDisabled) {
+    // Read only, so it stays legible while a render locks the settings below
+    if (inputDisabled) ImGui::EndDisabled();
+    renderStats();
+    if (inputDisabled) ImGui::BeginDisabled();
+
     if (ImGui::CollapsingHeader("Render")) {
         if (ImGui::BeginTable("RenderTable", 2, ImGuiTableFlags_SizingStretchSame)) {
             ImGui::TableSetupColumn("Property", ImGuiTableColumnFlags_WidthStretch, 1.0f);// 2x weight
@@ -334,10 +474,84 @@ void Display::renderConfig() {
             fullWidth();
             ImGui::InputInt("##MaxDepth", &camera_->maxDepth_, 0);
 
+            tableRow("Sample Clamp");
+            ImGui::InputFloat("##SampleClamp", &camera_->maxSampleValue_, 0);
+
+            tableRow("Radiance Cache");
+            ImGui::Checkbox("##RadianceCache", &camera_->useRadianceCache_);
+
+            tableRow("Denoise");
+            ImGui::Checkbox("##Denoise", &camera_->denoise_);
+
+            tableRow("Reprojection");
+            ImGui::Checkbox("##Reprojection", &dynamicCamera_->reprojection_);
+
+            tableRow("Tile Order");
+            const char *tileOrders[] = {"Row Major", "Morton", "Hilbert"};
+            int tileOrder            = static_cast<int>(camera_->tileOrder_);
+            if (ImGui::Combo("##TileOrder", &tileOrder, tileOrders, IM_ARRAYSIZE(tileOrders))) {
+                camera_->tileOrder_ = static_cast<TileOrder>(tileOrder);
+            }
+
+            tableRow("Auto Tile Size");
+            ImGui::Checkbox("##AutoTileSize", &camera_->autoTileSize_);
+
+            tableRow("Traversal Heatmap");
+            ImGui::Checkbox("##TraversalHeatmap", &camera_->traversalHeatmap_);
+
+            tableRow("Checkpoint");
+            bool checkpoint = !camera_->checkpointPath_.empty();
+            if (ImGui::Checkbox("##Checkpoint", &checkpoint)) {
+                camera_->checkpointPath_ = checkpoint ? DEFAULT_CHECKPOINT_PATH : "";
+            }
+
+            tableRow("Resume");
+            ImGui::Checkbox("##Resume", &camera_->resume_);
+
+            // Only scenes loaded with a budget stream their textures, see the texture-budget setting
+            if (scene_ && scene_->textureCache) {
+                int budget = static_cast<int>(scene_->textureCache->stats().budgetBytes >> 20);
+                tableRow("Texture Budget MB");
+                if (ImGui::InputInt("##TextureBudget", &budget, 0)) {
+                    scene_->textureCache->setBudget(static_cast<size_t>(std::max(budget, 1)) << 20);
+                }
+            }
+
             ImGui::EndTable();
         }
     }
 
+#ifdef ENABLE_PROFILING
+    // The report is rewritten at the end of each render, so only show it in between
+    if (!isRendering_ && camera_->profile_.rays() > 0 && ImGui::CollapsingHeader("Profile")) {
+        const ProfileReport &profile = camera_->profile_;
+        if (ImGui::BeginTable("ProfileTable", 2, ImGuiTableFlags_SizingStretchSame)) {
+            ImGui::TableSetupColumn("Counter", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+            ImGui::TableSetupColumn("Value", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+
+            for (size_t i = 0; i < PROFILE_COUNTERS; ++i) {
+                tableRow(profileCounterName(static_cast<ProfileCounter>(i)));
+                ImGui::Text("%llu", static_cast<unsigned long long>(profile.counters[i]));
+            }
+
+            const auto rays = static_cast<double>(profile.rays());
+            tableRow("Nodes / Ray");
+            ImGui::Text("%.2f", static_cast<double>(profile[ProfileCounter::BVH_NODES]) / rays);
+            tableRow("Triangles / Ray");
+            ImGui::Text("%.2f", static_cast<double>(profile[ProfileCounter::TRIANGLE_TESTS]) / rays);
+            tableRow("Mrays/s");
+            ImGui::Text("%.2f", profile.seconds > 0 ? rays / profile.seconds / 1e6 : 0.0);
+
+            ImGui::EndTable();
+        }
+
+        ImGui::SeparatorText("Path Lengths");
+        float lengths[PATH_LENGTH_BUCKETS];
+        for (size_t i = 0; i < PATH_LENGTH_BUCKETS; ++i) lengths[i] = static_cast<float>(profile.pathLengths[i]);
+        ImGui::PlotHistogram("##PathLengths", lengths, PATH_LENGTH_BUCKETS, 0, nullptr, 0.0f, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x, 60));
+    }
+#endif
+
 
     if (ImGui::CollapsingHeader("Camera")) {
         ImGui::SeparatorText("Orientation");
@@ -692,15 +906,21 @@ void Display::render() {
     ImGui_ImplSDL2_NewFrame();
     ImGui::NewFrame();
 
+    // The scene can't be edited while either camera is tracing it
     bool inputDisabled = false;
-    if (isRendering_) {
+    if (isRendering_ || interactiveMode_) {
         inputDisabled = true;
     }
 
     renderMenuBar(inputDisabled);
 
+    if (interactiveMode_ && resetRender_) {
+        renderInteractive();
+    }
+
+    Camera *view = interactiveMode_ ? static_cast<Camera *>(dynamicCamera_) : camera_;
     glBindTexture(GL_TEXTURE_2D, textureId_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, camera_->width_, camera_->height_, 0, GL_RGB, GL_UNSIGNED_BYTE, camera_->img_.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, view->width_, view->height_, 0, GL_RGB, GL_UNSIGNED_BYTE, view->resolveImage().data());
 
     glViewport(0, 0, renderWidth_, height_);
 
@@ -747,7 +967,7 @@ void Display::render() {
 
     if (ImGui::BeginTabBar("SidebarTabs", ImGuiTabBarFlags_None)) {
         if (ImGui::BeginTabItem("Configuration")) {
-            renderConfig();
+            renderConfig(inputDisabled);
             ImGui::EndTabItem();
         }
         if (ImGui::BeginTabItem("Scene")) {
@@ -909,6 +1129,30 @@ void Display::renderScene() {
     }).detach();
 }
 
+void Display::renderInteractive() {
+    resetRender_ = false;
+    if (rebuildBVH_) {
+        dynamicCamera_->stopRender();
+        scene_->rebuildBVH();
+        dynamicCamera_->discardRadianceCache();
+        rebuildBVH_ = false;
+    }
+
+    if (dynamicCamera_->width_ != camera_->width_ || dynamicCamera_->height_ != camera_->height_) {
+        dynamicCamera_->resize(camera_->width_, camera_->height_);
+    }
+    dynamicCamera_->properties_       = camera_->properties_;
+    dynamicCamera_->xPixelSamples_    = camera_->xPixelSamples_;
+    dynamicCamera_->yPixelSamples_    = camera_->yPixelSamples_;
+    dynamicCamera_->maxDepth_         = camera_->maxDepth_;
+    dynamicCamera_->maxSampleValue_   = camera_->maxSampleValue_;
+    dynamicCamera_->useRadianceCache_ = camera_->useRadianceCache_;
+    dynamicCamera_->tileOrder_        = camera_->tileOrder_;
+
+    // Returns straight away, the coarsest preview level lands within a frame
+    dynamicCamera_->render(*scene_);
+}
+
 void Display::updateScale() {
     windowScale_ = static_cast<float>(width_) / static_cast<float>(logicalWidth_);
     renderWidth_ = width_ - (SIDEBAR_WIDTH * windowScale_);
@@ -926,6 +1170,10 @@ void Display::updateScale() {
 }
 
 void Display::processEvents(bool &isRunning) {
+    // Motion deltas only hold for the events of this frame
+    mState_.deltaX = 0;
+    mState_.deltaY = 0;
+
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
         ImGui_ImplSDL2_ProcessEvent(&e);
@@ -974,13 +1222,15 @@ void Display::processEvents(bool &isRunning) {
         }
     }
 
-    if (mState_.isOverViewport) {
-        if (mState_.middleButtonDown) {
+    // Navigation is only live in interactive mode, a static render reads the camera until it finishes
+    if (interactiveMode_ && mState_.isOverViewport) {
+        if (mState_.middleButtonDown && (mState_.deltaX != 0 || mState_.deltaY != 0)) {
             if (mState_.shiftDown) {
                 // Pan the camera
                 panCamera(mState_.deltaX, mState_.deltaY);
             } else {
                 // Rotate the camera
+                rotateCamera(mState_.deltaX, mState_.deltaY);
             }
         }
         if (mState_.scroll != 0) {
@@ -1008,6 +1258,26 @@ void Display::zoomCamera(int scroll) {
     camera_->properties_.center = camera_->properties_.target + (camera_->properties_.center - camera_->properties_.target) * zoomFactor;
 }
 
-void Display::rotateCamera() {
-    resetRender_ = true;
+// Rotates v around a unit axis
+static Vec3 rotateAround(const Vec3 &v, const Vec3 &axis, const float angle) {
+    const float cosTheta = jtx::cos(angle);
+    const float sinTheta = jtx::sin(angle);
+    return v * cosTheta + cross(axis, v) * sinTheta + axis * dot(axis, v) * (1.0f - cosTheta);
+}
+
+void Display::rotateCamera(const int deltaX, const int deltaY) {
+    resetRender_      = true;
+    const Vec3 up     = normalize(camera_->properties_.up);
+    const Vec3 offset = camera_->properties_.center - camera_->properties_.target;
+    const Vec3 right  = normalize(cross(offset, up));
+    const float yaw   = static_cast<float>(-deltaX) * camSensitivity_;
+    const float pitch = static_cast<float>(-deltaY) * camSensitivity_;
+
+    // Orbit around the target, yaw about the up vector and pitch about the camera's right axis
+    Vec3 rotated       = rotateAround(offset, up, yaw);
+    const Vec3 pitched = rotateAround(rotated, rotateAround(right, up, yaw), pitch);
+
+    // Stop short of the poles, where the view would flip over
+    if (jtx::abs(dot(normalize(pitched), up)) < 0.99f) rotated = pitched;
+    camera_->properties_.center = camera_->properties_.target + rotated;
 }
@@ -8,11 +8,15 @@
 #include <SDL_video.h>
 #include "imgui.h"
 #include <imfilebrowser.h>
+#include <vector>
 
 // Both in logical pixels
 constexpr int SIDEBAR_WIDTH = 400;
 constexpr int FONT_SIZE     = 14;
 
+// Written to the working directory when checkpointing is enabled from the UI
+constexpr const char *DEFAULT_CHECKPOINT_PATH = "render.jtxc";
+
 struct MouseState {
     bool leftButtonDown = false;
     bool middleButtonDown = false;
@@ -26,9 +30,25 @@ struct MouseState {
     bool isOverViewport = false;
 };
 
+/**
+ * Rates of the running render, derived from two samples of its stats a fraction of a second apart so the numbers
+ * stay readable
+ */
+struct LiveStats {
+    const Camera *camera = nullptr;
+    RenderStats last;
+    uint64_t lastRays = 0;
+
+    double samplesPerSecond     = 0;
+    double raysPerSecond        = 0;
+    double tileSamplesPerSecond = 0;
+    // Fraction of the last interval each thread spent rendering tiles
+    std::vector<float> utilization;
+};
+
 class Display {
 public:
-    Display(int width, int height, StaticCamera *camera);
+    Display(int width, int height, StaticCamera *camera, DynamicCamera *dynamicCamera);
 
     bool init();
 
@@ -66,15 +86,21 @@ private:
     GLuint vao_, vbo_, ebo_;
 
     MouseState mState_;
+    // Viewport navigation drives dynamicCamera_, which restarts with a coarse preview after every move
     bool interactiveMode_ = false;
-    float camSensitivity_ = false;
+    float camSensitivity_ = 0.01f;
     bool resetRender_ = false;
 
     uint32_t frame_;
 
     void panCamera(int deltaX, int deltaY);
     void zoomCamera(int scroll);
-    void rotateCamera();
+    void rotateCamera(int deltaX, int deltaY);
+
+    /**
+     * Copies the view and render settings of the static camera to the dynamic one and restarts its render
+     */
+    void renderInteractive();
 
     bool initWindow();
     bool initShaders();
@@ -83,11 +109,13 @@ private:
 
     void renderScene();
     void renderMenuBar(bool inputDisabled);
-    void renderConfig();
+    void renderConfig(bool inputDisabled);
+    void renderStats();
     void renderMaterialEditor(const size_t selectedMeshIndex);
     void renderLightEditor(const size_t selectedLightIndex) const;
     void renderSceneEditor();
     bool isRendering_ = false;
+    LiveStats liveStats_;
 
     void updateScale();
 
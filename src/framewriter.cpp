@@ -0,0 +1,151 @@
+#include "framewriter.hpp"
+#include "profile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+bool writeFrame(const Frame &frame) {
+    PROFILE_SCOPE("Write frame");
+    if (frame.isEXR()) return frame.film.saveEXR(frame.path.c_str(), frame.tileSamples, frame.tileSize);
+    return frame.image.save(frame.path.c_str());
+}
+
+bool VideoStream::open(const std::string &path, const Format format, const int width, const int height, const Float fps) {
+    close();
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file_     = stdout;
+        ownsFile_ = false;
+    } else {
+        file_     = std::fopen(path.c_str(), "wb");
+        ownsFile_ = true;
+    }
+    if (!file_) {
+        std::cerr << "Failed to open video stream: " << path << std::endl;
+        return false;
+    }
+
+    format_ = format;
+    width_  = width;
+    height_ = height;
+    row_.resize(width);
+
+    if (format_ == Format::Y4M) {
+        // Frame rate as a ratio, exact for integer rates
+        const long rate  = std::lround(fps * 1000);
+        const bool whole = rate % 1000 == 0;
+        std::fprintf(file_, "YUV4MPEG2 W%d H%d F%ld:%d Ip A1:1 C444\n", width, height, whole ? rate / 1000 : rate, whole ? 1 : 1000);
+    }
+    return true;
+}
+
+bool VideoStream::write(const RGB8Image &image) {
+    if (!file_ || image.w_ != width_ || image.h_ != height_) return false;
+    const RGB *pixels = image.data();
+
+    if (format_ == Format::RAW_RGB) {
+        static_assert(sizeof(RGB) == 3);
+        for (int row = height_ - 1; row >= 0; --row) {
+            if (std::fwrite(pixels + static_cast<size_t>(row) * width_, 3, width_, file_) != static_cast<size_t>(width_)) return false;
+        }
+        return true;
+    }
+
+    // BT.601 limited range in 8-bit fixed point, one plane after another
+    auto luma   = [](const RGB &p) { return ((66 * p.R + 129 * p.G + 25 * p.B + 128) >> 8) + 16; };
+    auto blueCb = [](const RGB &p) { return ((-38 * p.R - 74 * p.G + 112 * p.B + 128) >> 8) + 128; };
+    auto redCr  = [](const RGB &p) { return ((112 * p.R - 94 * p.G - 18 * p.B + 128) >> 8) + 128; };
+
+    if (std::fputs("FRAME\n", file_) < 0) return false;
+    for (int plane = 0; plane < 3; ++plane) {
+        for (int row = height_ - 1; row >= 0; --row) {
+            const RGB *src = pixels + static_cast<size_t>(row) * width_;
+            for (int col = 0; col < width_; ++col) {
+                const int v = plane == 0 ? luma(src[col]) : plane == 1 ? blueCb(src[col]) : redCr(src[col]);
+                row_[col]   = static_cast<unsigned char>(v);
+            }
+            if (std::fwrite(row_.data(), 1, width_, file_) != static_cast<size_t>(width_)) return false;
+        }
+    }
+    return true;
+}
+
+void VideoStream::close() {
+    if (!file_) return;
+    std::fflush(file_);
+    if (ownsFile_) std::fclose(file_);
+    file_ = nullptr;
+}
+
+FrameWriter::FrameWriter(const size_t capacity)
+    : FrameWriter(capacity, nullptr) {}
+
+FrameWriter::FrameWriter(const size_t capacity, std::unique_ptr<VideoStream> stream)
+    : stream_(std::move(stream)) {
+    for (size_t i = 0; i < std::max<size_t>(capacity, 1); ++i) {
+        frames_.push_back(std::make_unique<Frame>());
+        free_.push_back(frames_.back().get());
+    }
+    thread_ = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+    finish();
+}
+
+Frame &FrameWriter::acquire() {
+    std::unique_lock lock(mutex_);
+    condition_.wait(lock, [this] { return !free_.empty(); });
+    Frame *frame = free_.front();
+    free_.pop_front();
+    return *frame;
+}
+
+void FrameWriter::submit(Frame &frame) {
+    {
+        std::lock_guard lock(mutex_);
+        queued_.push_back(&frame);
+    }
+    condition_.notify_all();
+}
+
+void FrameWriter::finish() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    if (thread_.joinable()) thread_.join();
+    if (stream_) stream_->close();
+}
+
+void FrameWriter::run() {
+    while (true) {
+        Frame *frame;
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return !queued_.empty() || stop_; });
+            if (queued_.empty()) return;
+            frame = queued_.front();
+            queued_.pop_front();
+        }
+
+        const bool written = stream_ ? stream_->write(frame->image) : writeFrame(*frame);
+        if (!written) std::cerr << "Failed to write frame: " << frame->path << std::endl;
+
+        {
+            std::lock_guard lock(mutex_);
+            if (!written) ++failures_;
+            free_.push_back(frame);
+        }
+        condition_.notify_all();
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "image.hpp"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Finished frame on its way to disk. Holds either the display image (PNG) or the film (EXR), depending on the
+ * extension of path.
+ */
+struct Frame {
+    std::string path;
+    RGB8Image image;
+
+    // EXR output: the film and the sample count of each of its tiles
+    AccumulationBuffer film;
+    std::vector<int> tileSamples;
+    int tileSize = 0;
+
+    bool isEXR() const { return path.ends_with(".exr") || path.ends_with(".EXR"); }
+};
+
+/**
+ * Writes a frame to frame.path
+ * @return True on success
+ */
+bool writeFrame(const Frame &frame);
+
+/**
+ * Uncompressed video written frame after frame to a single file or to stdout, for an external encoder to consume,
+ * e.g. `ffmpeg -i - out.mp4` for Y4M or `ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i - out.mp4` for raw RGB.
+ *
+ * Rows are written straight from the bottom-up image buffer in top-down order, so there is no per-frame copy.
+ */
+class VideoStream {
+public:
+    enum class Format {
+        // YUV4MPEG2, 8-bit 4:4:4 with BT.601 limited range colour. Self-describing, so encoders need no options.
+        Y4M,
+        // Packed 8-bit RGB with no header
+        RAW_RGB,
+    };
+
+    VideoStream() = default;
+    ~VideoStream() { close(); }
+
+    VideoStream(const VideoStream &)            = delete;
+    VideoStream &operator=(const VideoStream &) = delete;
+
+    /**
+     * Opens the stream and writes the header, if the format has one
+     * @param path Output file, "-" for stdout
+     * @param format Stream format
+     * @param width Frame width
+     * @param height Frame height
+     * @param fps Frame rate recorded in the header
+     * @return False if the file can't be opened
+     */
+    bool open(const std::string &path, Format format, int width, int height, Float fps);
+
+    /**
+     * Appends a frame, which has to match the size the stream was opened with
+     * @return False on a size mismatch or write error
+     */
+    bool write(const RGB8Image &image);
+
+    /**
+     * Flushes the stream and closes it, unless it is stdout
+     */
+    void close();
+
+private:
+    FILE *file_    = nullptr;
+    bool ownsFile_ = false;
+    Format format_ = Format::Y4M;
+    int width_     = 0;
+    int height_    = 0;
+    // One row of one plane, the Y4M planes are converted row by row
+    std::vector<unsigned char> row_;
+};
+
+/**
+ * Background frame encoder
+ *
+ * Frames are written on a dedicated I/O thread while the next one renders. The writer owns a fixed set of frame
+ * buffers: acquire() hands out a free one, blocking while all of them are still queued or being written, so a slow
+ * disk holds the renderer back instead of piling up frames in memory. Buffers are reused, so after the first few
+ * frames capturing one doesn't allocate.
+ */
+class FrameWriter {
+public:
+    /**
+     * @param capacity Number of frame buffers, frames that can be queued or in flight at once
+     */
+    explicit FrameWriter(size_t capacity = 2);
+
+    /**
+     * Writes the frames' images to an open stream instead of to the frames' paths
+     * @param capacity Number of frame buffers, frames that can be queued or in flight at once
+     * @param stream Open video stream, closed by finish()
+     */
+    FrameWriter(size_t capacity, std::unique_ptr<VideoStream> stream);
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &)            = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /**
+     * @return A free frame buffer to capture into, blocks until one is available
+     */
+    Frame &acquire();
+
+    /**
+     * Queues a frame from acquire() to be written, frames are written in submission order
+     */
+    void submit(Frame &frame);
+
+    /**
+     * Writes all queued frames, stops the writer thread and closes the stream, if any
+     */
+    void finish();
+
+    /**
+     * @return Number of frames that failed to write
+     */
+    int failures() const {
+        std::lock_guard lock(mutex_);
+        return failures_;
+    }
+
+private:
+    std::unique_ptr<VideoStream> stream_;
+    std::vector<std::unique_ptr<Frame>> frames_;
+    std::deque<Frame *> free_;
+    std::deque<Frame *> queued_;
+
+    std::thread thread_;
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    int failures_ = 0;
+    bool stop_    = false;
+
+    void run();
+};
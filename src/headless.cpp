@@ -0,0 +1,160 @@
+#include "camera.hpp"
+#include "framewriter.hpp"
+#include "job.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [--job <file>] [--<setting> <value>]...\n"
+              << "\n"
+              << "Settings, as `key = value` lines in a job file or as options (options override the job file):\n"
+              << "  scene       Scene file, or a built-in scene: shaderball, knob, mesh (default shaderball)\n"
+              << "  width       Image width (default 800)\n"
+              << "  height      Image height (default 400)\n"
+              << "  spp         Samples per pixel (default 64)\n"
+              << "  max-depth   Maximum path depth (default 50)\n"
+              << "  clamp       Per-channel clamp of each sample, inf for unclamped HDR (default 1)\n"
+              << "  threads     Worker threads, 0 for all cores (default 0)\n"
+              << "  integrator  basic, path or mis (default mis)\n"
+              << "  output      Output image (.png, .exr), video stream (.y4m, .rgb) or - for stdout (default render.png)\n"
+              << "  format      auto, y4m or rgb, forces a video stream format (default auto)\n"
+              << "  denoise     Denoise the finished render, true/false (default false)\n"
+              << "  checkpoint  Checkpoint file, enables checkpointing\n"
+              << "  resume      Continue from the checkpoint, true/false (default false)\n"
+              << "  animation   Animation file, renders a sequence to output with #### replaced by the frame number\n"
+              << "  tiles       Range of 32 pixel tiles to render, begin:end with end excluded or empty for all (default 0:)\n"
+              << "  samples     Range of each pixel's samples to render, begin:end like tiles (default 0:)\n"
+              << "  film        Write the float film here instead of output, to be combined with JTXMerge\n"
+              << "  heatmap     Output a heatmap of BVH nodes and triangles visited per sample, true/false (default false)\n"
+              << "  texture-budget  MB of texture tiles kept in memory, loaded on demand from tiled files, 0 loads textures whole (default 0)\n"
+              << "  texture-cache   Directory of the tiled texture files (default .texcache)\n"
+              << "  center      Camera position, x,y,z\n"
+              << "  target      Camera target, x,y,z\n"
+              << "  fov         Vertical field of view in degrees\n"
+              << "\n"
+              << "Environment:\n"
+              << "  JTX_TRACE   Record the render phases and write them to this file as a Chrome trace on exit,\n"
+              << "              only in builds with ENABLE_PROFILING\n";
+}
+
+// Reports how well the texture budget held the working set, if textures were loaded through the cache
+static void logTextureCache(const Scene &scene, std::ostream &log) {
+    if (!scene.textureCache) return;
+    const auto stats = scene.textureCache->stats();
+    log << "Texture cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+        << (stats.residentBytes >> 20) << " of " << (stats.budgetBytes >> 20) << " MB resident" << std::endl;
+}
+
+// Frames that can be waiting for or in the middle of being written while the next one renders
+static constexpr size_t FRAME_BUFFERS = 2;
+
+// Renders the animation frame by frame, each frame is written on the I/O thread while the next one renders
+static int renderAnimation(const RenderJob &job, const Scene &scene, StaticCamera &camera, std::ostream &log) {
+    Animation animation;
+    if (!loadAnimationFile(job.animation, animation)) return 1;
+
+    if (!camera.checkpointPath_.empty()) {
+        std::cerr << "Checkpointing is not supported for animations, ignoring it" << std::endl;
+        camera.checkpointPath_.clear();
+    }
+
+    // Streams go to a single output, image sequences to one file per frame
+    const auto streamFormat = jobStreamFormat(job);
+    std::unique_ptr<VideoStream> stream;
+    if (streamFormat) {
+        stream = std::make_unique<VideoStream>();
+        if (!stream->open(job.output, *streamFormat, job.width, job.height, animation.fps)) return 1;
+    }
+
+    const CameraProperties base = scene.cameraProperties;
+    const int frameCount        = animation.frameCount();
+    FrameWriter writer(FRAME_BUFFERS, std::move(stream));
+
+    for (int frame = 0; frame < frameCount; ++frame) {
+        camera.properties_ = animation.cameraAt(static_cast<Float>(frame) / animation.fps, base);
+
+        const auto start = std::chrono::steady_clock::now();
+        camera.render(scene);
+        const auto end = std::chrono::steady_clock::now();
+
+        // Only blocks if the writer has fallen FRAME_BUFFERS frames behind
+        const std::string path = streamFormat ? std::string() : framePath(job.output, frame);
+        Frame &out             = writer.acquire();
+        camera.captureFrame(path, out);
+        writer.submit(out);
+
+        log << "Rendered frame " << frame + 1 << "/" << frameCount << " in "
+            << std::chrono::duration<double>(end - start).count() << "s -> " << (streamFormat ? job.output : path) << std::endl;
+    }
+
+    writer.finish();
+    return writer.failures() == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+            printUsage(argv[0]);
+            return 0;
+        }
+    }
+
+    RenderJob job;
+    if (!parseJobArgs(argc, argv, job)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Left at 0, the scheduler keeps one core for the calling thread, which renders alongside the workers
+    if (job.threads > 0) Scheduler::setGlobalThreadCount(job.threads);
+
+    const auto start = std::chrono::steady_clock::now();
+
+    Scene scene;
+    if (!loadJobScene(job, scene)) return 1;
+    scene.buildBVH();
+
+    // Keep stdout clean when the video is streamed through it
+    std::ostream &log = job.output == "-" ? std::cerr : std::cout;
+
+    const auto loaded = std::chrono::steady_clock::now();
+    log << "Loaded " << job.scene << " (" << scene.numPrimitives() << " primitives) in "
+        << std::chrono::duration<double>(loaded - start).count() << "s" << std::endl;
+
+    const auto [xSamples, ySamples] = strataForSpp(job.spp);
+    StaticCamera camera{job.width, job.height, scene.cameraProperties, xSamples, ySamples, job.maxDepth};
+    applyJobSettings(job, camera);
+
+    if (!job.animation.empty()) {
+        if (camera.isPartial() || !job.film.empty()) {
+            std::cerr << "Partial renders are not supported for animations" << std::endl;
+            scene.destroy();
+            return 1;
+        }
+        const int result = renderAnimation(job, scene, camera, log);
+        logTextureCache(scene, log);
+        scene.destroy();
+        return result;
+    }
+
+    if (camera.isPartial()) {
+        log << "Rendering tiles " << job.tileBegin << ":" << (job.tileEnd < 0 ? camera.defaultTileCount() : job.tileEnd) << " of "
+            << camera.defaultTileCount() << ", samples " << job.sampleBegin << ":" << (job.sampleEnd < 0 ? job.spp : job.sampleEnd) << std::endl;
+    }
+    camera.render(scene);
+
+    const auto rendered = std::chrono::steady_clock::now();
+    log << "Rendered " << job.width << "x" << job.height << " @ " << xSamples * ySamples << " spp in "
+        << std::chrono::duration<double>(rendered - loaded).count() << "s" << std::endl;
+    logTextureCache(scene, log);
+
+    const bool written = writeJobOutput(job, camera);
+    if (written) log << "Saved " << (job.film.empty() ? job.output : job.film) << std::endl;
+
+    scene.destroy();
+    return written ? 0 : 1;
+}
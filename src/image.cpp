@@ -1,4 +1,15 @@
 #include "image.hpp"
+#include "scheduler.hpp"
+
+#include <cstring>
+
+#ifdef ENABLE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #define STB_IMAGE_IMPLEMENTATION
@@ -8,50 +19,260 @@
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
 
-void RGB8Image::save(const char *path) const {
-    std::vector<unsigned char> flipped_buffer(w_ * h_ * 3);
+#ifdef ENABLE_AVX2
+
+// The build doesn't target AVX2 as a whole, so render nodes without it still run the scalar paths. Only the kernel
+// is compiled for AVX2, and it is only called once the CPU and OS are known to support it.
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+static bool cpuHasAVX2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+
+    // The OS has to save the YMM registers on context switches as well
+    __cpuid(info, 1);
+    const bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesAVX && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static const bool HAS_AVX2 = cpuHasAVX2();
+
+/**
+ * Resolves pixels 8 at a time
+ * @return Number of pixels resolved, the remainder is left to the scalar loop
+ */
+AVX2_TARGET static int resolveSpanAVX2(const Vec3 *src, RGB *dst, const int n, const Float scale) {
+    static_assert(sizeof(Vec3) == 3 * sizeof(float) && sizeof(RGB) == 3);
+
+    // 8 pixels are 24 floats in, 24 bytes out. Every channel gets the same treatment, so the interleaved
+    // layout can be processed as-is without shuffling channels apart.
+    const auto *in      = reinterpret_cast<const float *>(src);
+    auto *out           = reinterpret_cast<unsigned char *>(dst);
+    const __m256 vScale = _mm256_set1_ps(scale);
+    const __m256 vZero  = _mm256_setzero_ps();
+    const __m256 vMax   = _mm256_set1_ps(MAX_INTENSITY);
+    const __m256 vRGB   = _mm256_set1_ps(RGB_SCALE);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 3; ++k) {
+            // max(x, 0) first also maps NaN to 0, like linearToGamma
+            __m256 v = _mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + 3 * i + 8 * k), vScale), vZero);
+            v        = _mm256_mul_ps(_mm256_min_ps(_mm256_sqrt_ps(v), vMax), vRGB);
+
+            const __m256i q   = _mm256_cvttps_epi32(v);
+            const __m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 3 * i + 8 * k), _mm_packus_epi16(q16, q16));
+        }
+    }
+    return i;
+}
+
+#endif
+
+// Resolves n pixels, src and dst are both packed RGB
+static void resolveSpan(const Vec3 *src, RGB *dst, const int n, const Float scale) {
+    int i = 0;
+#ifdef ENABLE_AVX2
+    if (HAS_AVX2) i = resolveSpanAVX2(src, dst, n, scale);
+#endif
+
+    for (; i < n; ++i) {
+        const Vec3 c = src[i] * scale;
+        dst[i].R     = static_cast<int>(RGB_SCALE * clampIntensity(linearToGamma(c.r)));
+        dst[i].G     = static_cast<int>(RGB_SCALE * clampIntensity(linearToGamma(c.g)));
+        dst[i].B     = static_cast<int>(RGB_SCALE * clampIntensity(linearToGamma(c.b)));
+    }
+}
+
+void RGB8Image::resolve(const AccumulationBuffer &acc, const Float scale, const int startRow, const int startCol, const int endRow, const int endCol) {
+    for (int row = startRow; row < endRow; ++row) {
+        const size_t i = static_cast<size_t>(row) * w_ + startCol;
+        resolveSpan(acc.data() + i, buffer.data() + i, endCol - startCol, scale);
+    }
+}
 
-    for (int y = 0; y < h_; ++y) {
-        for (int x = 0; x < w_; ++x) {
-            int src_index                 = (y * w_ + x) * 3;
-            int dst_index                 = ((h_ - 1 - y) * w_ + x) * 3;
-            flipped_buffer[dst_index]     = buffer[y * w_ + x].R;
-            flipped_buffer[dst_index + 1] = buffer[y * w_ + x].G;
-            flipped_buffer[dst_index + 2] = buffer[y * w_ + x].B;
+void RGB8Image::resolveWeighted(const AccumulationBuffer &acc, const Float *weights, const Float samples, const int startRow, const int startCol, const int endRow, const int endCol) {
+    for (int row = startRow; row < endRow; ++row) {
+        for (int col = startCol; col < endCol; ++col) {
+            const size_t i     = static_cast<size_t>(row) * w_ + col;
+            const Float weight = samples + weights[i];
+            setPixel(weight > 0 ? acc.data()[i] * (1.0f / weight) : Vec3{0, 0, 0}, row, col);
         }
     }
+}
 
-    stbi_write_png(path, w_, h_, 3, flipped_buffer.data(), w_ * 3);
+bool RGB8Image::save(const char *path) const {
+    // Rows are stored bottom-up, so hand stb the last row and a negative stride instead of a flipped copy
+    static_assert(sizeof(RGB) == 3);
+    const auto *lastRow = reinterpret_cast<const unsigned char *>(buffer.data() + static_cast<size_t>(h_ - 1) * w_);
+    return stbi_write_png(path, w_, h_, 3, lastRow, -w_ * 3) != 0;
 }
 
-TextureImage &TextureImage::operator=(TextureImage &&other) noexcept {
-    if (this != &other) {
-        if (data_) {
-            if (isExr_) {
-                free(data_);
-            } else {
-                stbi_image_free(data_);
+bool AccumulationBuffer::saveEXR(const char *path, const std::vector<int> &tileSamples, const int tileSize) const {
+    const size_t n = static_cast<size_t>(w_) * h_;
+
+    // EXR stores channels planar and in alphabetical order
+    std::vector<float> planes[3];
+    for (auto &plane : planes) plane.resize(n);
+
+    // Resolve by tile straight into the top-down planes, each tile averaged over its own sample count
+    const int tilesX = (w_ + tileSize - 1) / tileSize;
+    const int tilesY = (h_ + tileSize - 1) / tileSize;
+
+    Scheduler::global().parallelFor(tilesX * tilesY, [&](const size_t tile) {
+        const int startRow = static_cast<int>(tile / tilesX) * tileSize;
+        const int startCol = static_cast<int>(tile % tilesX) * tileSize;
+        const int endRow   = jtx::min(startRow + tileSize, h_);
+        const int endCol   = jtx::min(startCol + tileSize, w_);
+        const int samples  = tile < tileSamples.size() ? tileSamples[tile] : 0;
+        const float inv    = 1.0f / static_cast<float>(jtx::max(samples, 1));
+        for (int row = startRow; row < endRow; ++row) {
+            const size_t dst = static_cast<size_t>(h_ - 1 - row) * w_;
+            for (int col = startCol; col < endCol; ++col) {
+                const Vec3 c         = buffer_[row * w_ + col] * inv;
+                planes[0][dst + col] = c.b;
+                planes[1][dst + col] = c.g;
+                planes[2][dst + col] = c.r;
             }
         }
+    });
+
+    return saveEXRChannels(path, w_, h_, {{"B", planes[0].data()}, {"G", planes[1].data()}, {"R", planes[2].data()}});
+}
+
+bool saveEXRChannels(const char *path, const int width, const int height, const std::vector<std::pair<const char *, const float *>> &channels) {
+    const size_t count = channels.size();
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    EXRImage image;
+    InitEXRImage(&image);
+
+    std::vector<const float *> planes(count);
+    std::vector<EXRChannelInfo> channelInfos(count);
+    std::vector<int> pixelTypes(count, TINYEXR_PIXELTYPE_FLOAT), requestedTypes(count, TINYEXR_PIXELTYPE_FLOAT);
+    for (size_t c = 0; c < count; ++c) {
+        planes[c] = channels[c].second;
+        std::memset(&channelInfos[c], 0, sizeof(EXRChannelInfo));
+        std::strncpy(channelInfos[c].name, channels[c].first, 255);
+    }
+
+    image.images       = reinterpret_cast<unsigned char **>(const_cast<float **>(planes.data()));
+    image.num_channels = static_cast<int>(count);
+    image.width        = width;
+    image.height       = height;
+
+    header.num_channels          = static_cast<int>(count);
+    header.channels              = channelInfos.data();
+    header.pixel_types           = pixelTypes.data();
+    header.requested_pixel_types = requestedTypes.data();
+    header.compression_type      = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    const char *err = nullptr;
+    if (SaveEXRImageToFile(&image, &header, path, &err) != TINYEXR_SUCCESS) {
+        if (err) {
+            std::cerr << "Failed to save EXR file: " << err << std::endl;
+            FreeEXRErrorMessage(err);
+        }
+        return false;
+    }
+    return true;
+}
 
-        data_ = other.data_;
-        width_ = other.width_;
-        height_ = other.height_;
-        channels_ = other.channels_;
-        isExr_ = other.isExr_;
+void TextureImage::packHalf(const float *pixels, const int width, const int height, const int channels) {
+    width_    = width;
+    height_   = height;
+    channels_ = channels;
+    format_   = TexelFormat::F16;
 
-        other.data_ = nullptr;
-        other.width_ = other.height_ = other.channels_ = 0;
+    levels_   = {{width, height, 0}};
+
+    const size_t count = static_cast<size_t>(width) * height * channels;
+    data_.resize(count * sizeof(uint16_t));
+
+    auto *dst = reinterpret_cast<uint16_t *>(data_.data());
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = floatToHalf(pixels[i]);
+    }
+}
+
+template<typename T>
+void TextureImage::packInteger(const T *pixels, const int width, const int height, const int channels, const TexelFormat format) {
+    width_    = width;
+    height_   = height;
+    channels_ = channels;
+    format_   = format;
+    levels_   = {{width, height, 0}};
+
+    const size_t bytes = static_cast<size_t>(width) * height * channels * sizeof(T);
+    data_.resize(bytes);
+    std::memcpy(data_.data(), pixels, bytes);
+}
+
+void TextureImage::encode(const size_t i, const uint channel, const float value) {
+    const bool isColor = isColorChannel(channel);
+
+    switch (format_) {
+        case TexelFormat::U8: {
+            const float x = jtx::clamp(isColor ? linearToSRGB(value) : value, 0.0f, 1.0f);
+            data_[i]      = static_cast<uint8_t>(x * 255.0f + 0.5f);
+            break;
+        }
+        case TexelFormat::U16: {
+            const float x = jtx::clamp(isColor ? linearToSRGB(value) : value, 0.0f, 1.0f);
+            reinterpret_cast<uint16_t *>(data_.data())[i] = static_cast<uint16_t>(x * 65535.0f + 0.5f);
+            break;
+        }
+        case TexelFormat::F16:
+            reinterpret_cast<uint16_t *>(data_.data())[i] = floatToHalf(value);
+            break;
     }
-    return *this;
 }
 
-TextureImage::~TextureImage() {
-    if (data_) {
-        if (isExr_) {
-            free(data_);
-        } else {
-            stbi_image_free(data_);
+void TextureImage::buildMipmaps() {
+    if (levels_.size() != 1 || cache_) return;
+
+    // Lay out every level back to back so the pyramid is a single allocation
+    size_t elements = static_cast<size_t>(width_) * height_ * channels_;
+    int w = width_, h = height_;
+    while (w > 1 || h > 1) {
+        w = jtx::max(1, w / 2);
+        h = jtx::max(1, h / 2);
+        levels_.push_back({w, h, elements});
+        elements += static_cast<size_t>(w) * h * channels_;
+    }
+    data_.resize(elements * elementSize());
+
+    for (size_t l = 1; l < levels_.size(); ++l) {
+        const MipLevel &src = levels_[l - 1];
+        const MipLevel &dst = levels_[l];
+
+        for (int y = 0; y < dst.height; ++y) {
+            // Odd sizes fold the last row/column into the previous texel
+            const int y0 = jtx::min(2 * y, src.height - 1);
+            const int y1 = jtx::min(2 * y + 1, src.height - 1);
+            for (int x = 0; x < dst.width; ++x) {
+                const int x0 = jtx::min(2 * x, src.width - 1);
+                const int x1 = jtx::min(2 * x + 1, src.width - 1);
+
+                const size_t out = texelIndex(dst, x, y);
+                for (int c = 0; c < channels_; ++c) {
+                    const float sum = decodeRaw(texel(l - 1, x0, y0), c) + decodeRaw(texel(l - 1, x1, y0), c) +
+                                      decodeRaw(texel(l - 1, x0, y1), c) + decodeRaw(texel(l - 1, x1, y1), c);
+                    encode(out + c, c, sum * 0.25f);
+                }
+            }
         }
     }
 }
@@ -62,14 +283,28 @@ bool TextureImage::load(const char *path) {
 
     if (ext == "exr" || ext == "EXR") {
         // Use TinyEXR for EXR files
-        isExr_ = true;
         return loadEXR(path);
+    }
+
+    // Use stb_image for other formats, keeping the source precision
+    int w, h, c;
+    if (stbi_is_hdr(path)) {
+        float *pixels = stbi_loadf(path, &w, &h, &c, 0);
+        if (!pixels) return false;
+        packHalf(pixels, w, h, c);
+        stbi_image_free(pixels);
+    } else if (stbi_is_16_bit(path)) {
+        stbi_us *pixels = stbi_load_16(path, &w, &h, &c, 0);
+        if (!pixels) return false;
+        packInteger(pixels, w, h, c, TexelFormat::U16);
+        stbi_image_free(pixels);
     } else {
-        // Use stb_image for other formats
-        isExr_ = false;
-        data_  = stbi_loadf(path, &width_, &height_, &channels_, 0);
-        return data_ != nullptr;
+        stbi_uc *pixels = stbi_load(path, &w, &h, &c, 0);
+        if (!pixels) return false;
+        packInteger(pixels, w, h, c, TexelFormat::U8);
+        stbi_image_free(pixels);
     }
+    return true;
 }
 
 bool TextureImage::load(const unsigned char *buffer, const size_t bufferSize, const ImageFormat format) {
@@ -79,35 +314,46 @@ bool TextureImage::load(const unsigned char *buffer, const size_t bufferSize, co
     }
 
     if (format == ImageFormat::EXR) {
-        isExr_ = true;
-        const char *err;
-        const int ret = LoadEXRFromMemory(&data_, &width_, &height_, buffer, bufferSize, &err);
-        if (ret != TINYEXR_SUCCESS) {
-            if (err) {
-                std::cerr << "Failed to load EXR from memory: " << err << std::endl;
-                FreeEXRErrorMessage(err);
+        path_ = "mem_exr";
+        return loadEXR(buffer, bufferSize);
+    }
+
+    path_        = "mem_stbi";
+    const int sz = static_cast<int>(bufferSize);
+    int w, h, c;
+    if (stbi_is_hdr_from_memory(buffer, sz)) {
+        float *pixels = stbi_loadf_from_memory(buffer, sz, &w, &h, &c, 0);
+        if (!pixels) {
+            std::cerr << "Failed to load image from memory" << std::endl;
             return false;
-            }
         }
-        channels_ = 4;
-        path_ = "mem_exr";
-        return true;
+        packHalf(pixels, w, h, c);
+        stbi_image_free(pixels);
+    } else if (stbi_is_16_bit_from_memory(buffer, sz)) {
+        stbi_us *pixels = stbi_load_16_from_memory(buffer, sz, &w, &h, &c, 0);
+        if (!pixels) {
+            std::cerr << "Failed to load image from memory" << std::endl;
+            return false;
+        }
+        packInteger(pixels, w, h, c, TexelFormat::U16);
+        stbi_image_free(pixels);
     } else {
-        isExr_ = false;
-        data_ = stbi_loadf_from_memory(buffer, static_cast<int>(bufferSize), &width_, &height_, &channels_, 0);
-        if (!data_) {
+        stbi_uc *pixels = stbi_load_from_memory(buffer, sz, &w, &h, &c, 0);
+        if (!pixels) {
             std::cerr << "Failed to load image from memory" << std::endl;
             return false;
         }
-
-        path_ = "mem_stbi";
-        return true;
+        packInteger(pixels, w, h, c, TexelFormat::U8);
+        stbi_image_free(pixels);
     }
+    return true;
 }
 
 bool TextureImage::loadEXR(const char *path) {
+    float *pixels   = nullptr;
+    int w, h;
     const char *err = nullptr;
-    const int ret = LoadEXR(&data_, &width_, &height_, path, &err);
+    const int ret   = LoadEXR(&pixels, &w, &h, path, &err);
 
     if (ret != TINYEXR_SUCCESS) {
         if (err) {
@@ -117,6 +363,26 @@ bool TextureImage::loadEXR(const char *path) {
         return false;
     }
 
-    channels_ = 4;
+    packHalf(pixels, w, h, 4);
+    free(pixels);
+    return true;
+}
+
+bool TextureImage::loadEXR(const unsigned char *buffer, const size_t bufferSize) {
+    float *pixels   = nullptr;
+    int w, h;
+    const char *err = nullptr;
+    const int ret   = LoadEXRFromMemory(&pixels, &w, &h, buffer, bufferSize, &err);
+
+    if (ret != TINYEXR_SUCCESS) {
+        if (err) {
+            std::cerr << "Failed to load EXR from memory: " << err << std::endl;
+            FreeEXRErrorMessage(err);
+        }
+        return false;
+    }
+
+    packHalf(pixels, w, h, 4);
+    free(pixels);
     return true;
-}
\ No newline at end of file
+}
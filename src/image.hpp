@@ -2,6 +2,12 @@
 
 #include "rt.hpp"
 #include "util/color.hpp"
+#include "util/half.hpp"
+#include "texcache.hpp"
+
+#include <cmath>
+#include <string>
+#include <vector>
 
 constexpr Float MIN_INTENSITY = 0;
 constexpr Float MAX_INTENSITY = 0.999;
@@ -15,6 +21,8 @@ static Float clampIntensity(Float i) {
     return jtx::clamp(i, MIN_INTENSITY, MAX_INTENSITY);
 }
 
+class AccumulationBuffer;
+
 struct RGB {
     unsigned char R;
     unsigned char G;
@@ -51,7 +59,28 @@ public:
         buffer[i].B = static_cast<int>(RGB_SCALE * clampIntensity(linearToGamma(color.b)));
     }
 
-    void save(const char *path) const;
+    /**
+     * Converts a rectangle of accumulated linear colour to 8-bit gamma corrected pixels, same mapping as setPixel.
+     * Vectorized with AVX2 when built with ENABLE_AVX2 and the CPU supports it.
+     * @param acc Accumulated colour
+     * @param scale Multiplier applied before the conversion, 1 / sample count
+     */
+    void resolve(const AccumulationBuffer &acc, Float scale, int startRow, int startCol, int endRow, int endCol);
+
+    /**
+     * Like resolve, but for films seeded with a weighted history: each pixel is divided by the rectangle's sample
+     * count plus its own extra weight
+     * @param acc Accumulated colour
+     * @param weights Extra weight of each pixel, indexed like the film
+     * @param samples Samples accumulated into every pixel of the rectangle
+     */
+    void resolveWeighted(const AccumulationBuffer &acc, const Float *weights, Float samples, int startRow, int startCol, int endRow, int endCol);
+
+    /**
+     * Writes the image as PNG
+     * @return True on success
+     */
+    bool save(const char *path) const;
 
     [[nodiscard]] const RGB *data() const {
         return buffer.data();
@@ -86,47 +115,130 @@ public:
     }
 
     const Vec3 *data() const { return buffer_.data(); }
+    Vec3 *data() { return buffer_.data(); }
+
+    /**
+     * Writes the averaged film to a 32-bit float EXR, without clamping or tone mapping
+     * @param path Output path
+     * @param tileSamples Number of samples accumulated in each tile, tiles are numbered row-major
+     * @param tileSize Tile edge length in pixels
+     * @return True on success
+     */
+    bool saveEXR(const char *path, const std::vector<int> &tileSamples, int tileSize) const;
 
 private:
     std::vector<Vec3> buffer_;
 };
 
+/**
+ * Writes float planes to a ZIP compressed EXR, one channel each
+ * @param channels Channel names and their planes of width * height values, top row first. EXR requires them to be
+ * sorted by name.
+ * @return True on success
+ */
+bool saveEXRChannels(const char *path, int width, int height, const std::vector<std::pair<const char *, const float *>> &channels);
+
+/**
+ * Accumulates per-pixel first-hit albedo, normal and depth, plus the second moment of the luminance of the
+ * colour samples. Averaged by the sample count when read, like AccumulationBuffer.
+ */
+class AOVBuffer {
+public:
+    int w_, h_;
+
+    AOVBuffer()
+        : w_(1920),
+          h_(1080) {}
+    AOVBuffer(const int w, const int h)
+        : w_(w),
+          h_(h) { resize(w, h); }
+
+    void resize(const int w, const int h) {
+        w_ = w;
+        h_ = h;
+        albedo_.resize(w * h);
+        normal_.resize(w * h);
+        depth_.resize(w * h);
+        lumSq_.resize(w * h);
+    }
+
+    void clear() {
+        std::ranges::fill(albedo_, Vec3{0, 0, 0});
+        std::ranges::fill(normal_, Vec3{0, 0, 0});
+        std::ranges::fill(depth_, 0.0f);
+        std::ranges::fill(lumSq_, 0.0f);
+    }
+
+    void updatePixel(const Vec3 &albedo, const Vec3 &normal, const Float depth, const Float luminance, const uint32_t row, const uint32_t col) {
+        const auto i = row * w_ + col;
+        albedo_[i] += albedo;
+        normal_[i] += normal;
+        depth_[i] += depth;
+        lumSq_[i] += luminance * luminance;
+    }
+
+    const Vec3 *albedo() const { return albedo_.data(); }
+    const Vec3 *normal() const { return normal_.data(); }
+    const Float *depth() const { return depth_.data(); }
+    const Float *luminanceSq() const { return lumSq_.data(); }
+
+    Vec3 *albedo() { return albedo_.data(); }
+    Vec3 *normal() { return normal_.data(); }
+    Float *depth() { return depth_.data(); }
+    Float *luminanceSq() { return lumSq_.data(); }
+
+private:
+    std::vector<Vec3> albedo_;
+    std::vector<Vec3> normal_;
+    std::vector<Float> depth_;
+    std::vector<Float> lumSq_;
+};
+
 enum class ImageFormat {
     AUTO,
     EXR
 };
 
+/**
+ * Storage format of texels
+ *  - U8: 8-bit LDR images (PNG/JPG/...)
+ *  - U16: 16-bit images (16-bit PNG)
+ *  - F16: half-float HDR images (EXR/HDR)
+ */
+enum class TexelFormat {
+    U8,
+    U16,
+    F16
+};
+
+/**
+ * Encoding of the colour channels of integer textures. Float textures are always linear.
+ */
+enum class ColorEncoding {
+    LINEAR,
+    SRGB
+};
+
+/**
+ * Packed texture image
+ *
+ * Texels are kept in their source precision instead of being widened to 32-bit floats.
+ * Lookups decode to linear floats: sRGB colour maps go through a LUT, data maps are normalized.
+ */
 class TextureImage {
 public:
-    TextureImage()
-        : width_(0),
-          height_(0),
-          channels_(0),
-          data_(nullptr) {}
+    TextureImage() = default;
 
     explicit TextureImage(const char *path) { load(path); }
     explicit TextureImage(const unsigned char *buffer, size_t bufferSize, ImageFormat format) {
         load(buffer, bufferSize, format);
     }
 
-    TextureImage(TextureImage &&other) noexcept
-        : isExr_(other.isExr_),
-          path_(other.path_),
-          width_(other.width_),
-          height_(other.height_),
-          channels_(other.channels_),
-          data_(other.data_) {
-        other.data_  = nullptr;
-        other.path_  = "";
-        other.width_ = other.height_ = other.channels_ = 0;
-    }
-
-    TextureImage(const TextureImage &) = delete;
+    TextureImage(TextureImage &&other) noexcept            = default;
+    TextureImage &operator=(TextureImage &&other) noexcept = default;
 
+    TextureImage(const TextureImage &)            = delete;
     TextureImage &operator=(const TextureImage &) = delete;
-    TextureImage &operator=(TextureImage &&other) noexcept;
-
-    ~TextureImage();
 
     bool load(const char *path);
     bool load(const unsigned char *buffer, size_t bufferSize, ImageFormat format);
@@ -134,25 +246,46 @@ public:
     int width() const { return width_; }
     int height() const { return height_; }
     int channels() const { return channels_; }
+    TexelFormat format() const { return format_; }
 
-    const float *data() const { return data_; }
+    ColorEncoding encoding() const { return encoding_; }
 
-    Vec3 getTexel(const int u, const int v) const {
-        int wrappedU = u % width_;
-        if (wrappedU < 0) {
-            wrappedU += width_;
-        }
+    /**
+     * Sets how integer texels are decoded. Colour maps (albedo) are sRGB, data maps are linear.
+     * Ignored once the texture is cached, its tiles keep the encoding they were converted with.
+     * @param encoding Colour encoding
+     */
+    void setEncoding(const ColorEncoding encoding) {
+        if (!cache_) encoding_ = encoding;
+    }
 
-        int wrappedV = v % height_;
-        if (wrappedV < 0) {
-            wrappedV += height_;
-        }
+    /**
+     * @return Number of bytes used by the in-memory texel data, 0 once the texture is served by a TextureCache
+     */
+    size_t memoryUsage() const { return data_.size(); }
+
+    /**
+     * @return Number of MIP levels, 1 until buildMipmaps() is called
+     */
+    int levels() const { return static_cast<int>(levels_.size()); }
+
+    /**
+     * Builds the MIP pyramid down to 1x1 with a 2x2 box filter in linear space.
+     * Must be called after setEncoding() so sRGB maps are averaged correctly.
+     */
+    void buildMipmaps();
+
+    /**
+     * @return True if texels are fetched through a TextureCache instead of living in memory
+     */
+    bool cached() const { return cache_ != nullptr; }
 
-        const float *pixel = data_ + (wrappedV * width_ + wrappedU) * channels_;
-        return Vec3(pixel[0], pixel[1], pixel[2]);
+    Vec3 getTexel(const int u, const int v) const {
+        const uint8_t *t = texel(0, u, v);
+        return {decode(t, 0), decode(t, 1), decode(t, 2)};
     }
 
-    // Interpolated texel
+    // Nearest texel at full resolution
     Vec3 getTexel(const float u, const float v) const {
         const int x0 = static_cast<int>(u * width_);
         const int y0 = static_cast<int>(v * height_);
@@ -160,18 +293,7 @@ public:
     }
 
     float getTexel(const int u, const int v, const uint c0) const {
-        int wrappedU = u % width_;
-        if (wrappedU < 0) {
-            wrappedU += width_;
-        }
-
-        int wrappedV = v % height_;
-        if (wrappedV < 0) {
-            wrappedV += height_;
-        }
-
-        const float *pixel = data_ + (wrappedV * width_ + wrappedU) * channels_;
-        return pixel[c0];
+        return decode(texel(0, u, v), c0);
     }
 
     float getTexel(const float u, const float v, const uint c0) const {
@@ -181,18 +303,8 @@ public:
     }
 
     Vec2f getTexel(const int u, const int v, const uint c0, const uint c1) const {
-        int wrappedU = u % width_;
-        if (wrappedU < 0) {
-            wrappedU += width_;
-        }
-
-        int wrappedV = v % height_;
-        if (wrappedV < 0) {
-            wrappedV += height_;
-        }
-
-        const float *pixel = data_ + (wrappedV * width_ + wrappedU) * channels_;
-        return Vec2f(pixel[c0], pixel[c1]);
+        const uint8_t *t = texel(0, u, v);
+        return {decode(t, c0), decode(t, c1)};
     }
 
     Vec2f getTexel(const float u, const float v, const uint c0, const uint c1) const {
@@ -214,14 +326,198 @@ public:
         return getTexel(uv.x, uv.y, c0, c1);
     }
 
+    /**
+     * Trilinearly filtered lookup
+     * @param uv Texture coordinates
+     * @param width Filter width in UV space, 0 samples the full resolution level
+     */
+    Vec3 sample(const Vec2f &uv, const Float width) const {
+        const Trilerp taps = trilerpTaps(uv, width);
+        return {filter(taps, 0), filter(taps, 1), filter(taps, 2)};
+    }
+
+    float sample(const Vec2f &uv, const Float width, const uint c0) const {
+        return filter(trilerpTaps(uv, width), c0);
+    }
+
+    Vec2f sample(const Vec2f &uv, const Float width, const uint c0, const uint c1) const {
+        const Trilerp taps = trilerpTaps(uv, width);
+        return {filter(taps, c0), filter(taps, c1)};
+    }
+
 private:
-    bool isExr_;
+    friend class TextureCache;
+
     std::string path_;
 
+    int width_             = 0;
+    int height_            = 0;
+    int channels_          = 0;
+    TexelFormat format_    = TexelFormat::U8;
+    ColorEncoding encoding_ = ColorEncoding::LINEAR;
+    std::vector<uint8_t> data_;
+
+    /**
+     * A level of the MIP pyramid. All levels share data_, offset is in channel elements.
+     */
+    struct MipLevel {
+        int width, height;
+        size_t offset;
+    };
+    std::vector<MipLevel> levels_;
+
+    // Set once the texels have been handed over to a tiled cache
+    const TextureCache *cache_ = nullptr;
+    int cacheId_               = -1;
+
+    // Four texel taps of a bilinear lookup
+    struct Bilerp {
+        const uint8_t *texel[4];
+        float weight[4];
+    };
+
+    // Two bilinear lookups blended across adjacent MIP levels
+    struct Trilerp {
+        Bilerp lo, hi;
+        float t;
+    };
+
     bool loadEXR(const char *path);
+    bool loadEXR(const unsigned char *buffer, size_t bufferSize);
+
+    /**
+     * Packs decoded float texels to half floats
+     */
+    void packHalf(const float *pixels, int width, int height, int channels);
+
+    /**
+     * Copies decoded integer texels
+     */
+    template<typename T>
+    void packInteger(const T *pixels, int width, int height, int channels, TexelFormat format);
+
+    /**
+     * Wraps texel coordinates and returns the index of the first channel
+     */
+    size_t texelIndex(const MipLevel &level, const int u, const int v) const {
+        int wrappedU = u % level.width;
+        if (wrappedU < 0) {
+            wrappedU += level.width;
+        }
+
+        int wrappedV = v % level.height;
+        if (wrappedV < 0) {
+            wrappedV += level.height;
+        }
+
+        return level.offset + (static_cast<size_t>(wrappedV) * level.width + wrappedU) * channels_;
+    }
+
+    size_t elementSize() const {
+        return format_ == TexelFormat::U8 ? 1 : 2;
+    }
+
+    /**
+     * Wraps texel coordinates and returns a pointer to the first channel, going through the cache if attached
+     */
+    const uint8_t *texel(const int level, const int u, const int v) const {
+        const MipLevel &l = levels_[level];
+        if (cache_) {
+            int x = u % l.width;
+            if (x < 0) x += l.width;
+            int y = v % l.height;
+            if (y < 0) y += l.height;
+            return cache_->texel(cacheId_, level, x, y);
+        }
+        return data_.data() + texelIndex(l, u, v) * elementSize();
+    }
+
+    Bilerp bilerpTaps(const int level, const float u, const float v) const {
+        const MipLevel &l = levels_[level];
+        const float x  = u * l.width - 0.5f;
+        const float y  = v * l.height - 0.5f;
+        const float fx = std::floor(x);
+        const float fy = std::floor(y);
+        const int x0   = static_cast<int>(fx);
+        const int y0   = static_cast<int>(fy);
+        const float dx = x - fx;
+        const float dy = y - fy;
+
+        return {
+            {texel(level, x0, y0), texel(level, x0 + 1, y0), texel(level, x0, y0 + 1), texel(level, x0 + 1, y0 + 1)},
+            {(1 - dx) * (1 - dy), dx * (1 - dy), (1 - dx) * dy, dx * dy}};
+    }
+
+    /**
+     * Picks the two levels whose texel size brackets the filter width
+     */
+    Trilerp trilerpTaps(const Vec2f &uv, const Float width) const {
+        const int maxLevel = static_cast<int>(levels_.size()) - 1;
+        const float level  = static_cast<float>(maxLevel) + std::log2(jtx::max(width, 1e-8f));
+
+        if (level <= 0 || maxLevel == 0) {
+            const Bilerp b = bilerpTaps(0, uv.x, uv.y);
+            return {b, b, 0};
+        }
+        if (level >= static_cast<float>(maxLevel)) {
+            const Bilerp b = bilerpTaps(maxLevel, uv.x, uv.y);
+            return {b, b, 0};
+        }
+
+        const int lo = static_cast<int>(level);
+        return {bilerpTaps(lo, uv.x, uv.y), bilerpTaps(lo + 1, uv.x, uv.y), level - static_cast<float>(lo)};
+    }
+
+    float filter(const Bilerp &b, const uint c) const {
+        return b.weight[0] * decode(b.texel[0], c) + b.weight[1] * decode(b.texel[1], c) +
+               b.weight[2] * decode(b.texel[2], c) + b.weight[3] * decode(b.texel[3], c);
+    }
+
+    float filter(const Trilerp &taps, const uint c) const {
+        const float lo = filter(taps.lo, c);
+        if (taps.t == 0) return lo;
+        return (1 - taps.t) * lo + taps.t * filter(taps.hi, c);
+    }
+
+    /**
+     * @return True if the stored channel holds sRGB colour rather than alpha or data
+     */
+    bool isColorChannel(const uint channel) const {
+        return encoding_ == ColorEncoding::SRGB && channel < (channels_ >= 3 ? 3u : 1u);
+    }
+
+    /**
+     * Decodes a single channel to a linear float
+     * @param t First channel of the texel
+     * @param c Channel, grey images replicate their first channel into RGB
+     */
+    float decode(const uint8_t *t, const uint c) const {
+        const uint channel = channels_ >= 3 ? c : (c < 3 ? 0 : channels_ - 1);
+        return decodeRaw(t, channel);
+    }
+
+    /**
+     * Decodes a stored channel to a linear float, without grey replication
+     */
+    float decodeRaw(const uint8_t *t, const uint channel) const {
+        const bool isColor = isColorChannel(channel);
+
+        switch (format_) {
+            case TexelFormat::U8:
+                return isColor ? SRGB8_TO_LINEAR[t[channel]] : static_cast<float>(t[channel]) * (1.0f / 255.0f);
+            case TexelFormat::U16: {
+                const float x = static_cast<float>(reinterpret_cast<const uint16_t *>(t)[channel]) * (1.0f / 65535.0f);
+                return isColor ? sRGBToLinear(x) : x;
+            }
+            case TexelFormat::F16:
+                return halfToFloat(reinterpret_cast<const uint16_t *>(t)[channel]);
+            default:
+                return 0;
+        }
+    }
 
-    int width_;
-    int height_;
-    int channels_;
-    float *data_;
+    /**
+     * Encodes a linear float into a single channel, the inverse of decode()
+     */
+    void encode(size_t i, uint channel, float value);
 };
\ No newline at end of file
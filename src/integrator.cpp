@@ -1,6 +1,7 @@
 #include "integrator.hpp"
-#include "bsdf/bxdf.hpp"
+#include "bsdf/bsdf.hpp"
 #include "material.hpp"
+#include "profile.hpp"
 #include "util/interval.hpp"
 
 float powerHeuristic(const float nf, const float fPdf, const float ng, const float gPdf) {
@@ -13,6 +14,7 @@ Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng) {
     Vec3 radiance = {};
     Vec3 beta     = {1, 1, 1};
     int depth     = 0;
+    PROFILE_COUNT(CAMERA_RAYS);
 
     SurfaceIntersection record;
     while (beta) {
@@ -39,15 +41,19 @@ Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng) {
         Vec2f u2 = rng.sample<Vec2f>();
 
         // Sample BSDF
+        const BSDF bsdf(scene, record);
         BSDFSample s;
-        bool success = sampleBxdf(scene, record, w_o, u, u2, s);
+        PROFILE_COUNT(BSDF_SAMPLES);
+        bool success = bsdf.sample(w_o, u, u2, s);
         if (!success) break;
 
         // Update beta and set next ray
         beta *= s.fSample * jtx::absdot(s.w_i, record.normal) / s.pdf;
         ray = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+        PROFILE_COUNT(BOUNCE_RAYS);
     }
 
+    PROFILE_PATH_LENGTH(depth);
     return radiance;
 }
 
@@ -57,6 +63,7 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
     int depth           = 0;
     bool specularBounce = true;
     SurfaceIntersection record;
+    PROFILE_COUNT(CAMERA_RAYS);
 
     while (beta) {
         const bool hit = scene.closestHit(ray, Interval(0.001, INF), record);
@@ -80,6 +87,7 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
 
         // Both w_o and w_i face outwards
         Vec3 w_o = -ray.dir;
+        const BSDF bsdf(scene, record);
 
         {// Light sampling
             auto lightIdx = rng.sampleRange(scene.lights.size() - 1);
@@ -97,7 +105,7 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
             bool lightSampled = light.sample(ctx, ls, u);
             if (lightSampled && ls.pdf > 0) {
                 Vec3 w_i = ls.wi;
-                auto f   = evalBxdf(scene, record.material, record, w_o, w_i) * jtx::absdot(w_i, ctx.n);
+                auto f   = bsdf.evaluate(w_o, w_i) * jtx::absdot(w_i, ctx.n);
 
                 // Occlusion
                 // Offset ray from origin along normal to avoid self-collisions
@@ -106,6 +114,7 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
                 // Calculate distance for t parameter
                 const auto lDist = jtx::distance(record.point, ls.p);
 
+                if (f) PROFILE_COUNT(SHADOW_RAYS);
                 if (f && !scene.anyHit(sRay, Interval(0.0f, lDist - RAY_EPSILON))) {
                     radiance += beta * f * ls.radiance / (ls.pdf * (1.0f / static_cast<float>(scene.lights.size())));
                 }
@@ -118,7 +127,8 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
 
         // Sample BSDF
         BSDFSample s;
-        bool success = sampleBxdf(scene, record, w_o, u, u2, s);
+        PROFILE_COUNT(BSDF_SAMPLES);
+        bool success = bsdf.sample(w_o, u, u2, s);
         if (!success) break;
 
         // Update beta and set next ray
@@ -126,12 +136,14 @@ Vec3 integrate(Ray ray, const Scene &scene, const int maxDepth, RNG &rng) {
         specularBounce = s.isSpecular;
 
         ray = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+        PROFILE_COUNT(BOUNCE_RAYS);
     }
 
+    PROFILE_PATH_LENGTH(depth);
     return radiance;
 }
 
-Vec3 sampleLights(const Ray &r, const Scene &scene, const SurfaceIntersection &record, RNG &rng, LightSample &ls) {
+Vec3 sampleLights(const Ray &r, const Scene &scene, const SurfaceIntersection &record, const BSDF &bsdf, RNG &rng, LightSample &ls) {
     const auto lightIdx = rng.sampleRange(scene.lights.size() - 1);
     const Light &light  = scene.lights[lightIdx];
 
@@ -147,13 +159,14 @@ Vec3 sampleLights(const Ray &r, const Scene &scene, const SurfaceIntersection &r
         const auto sRay    = Ray(sOrigin, ls.wi);
         const auto lDist   = jtx::distance(record.point, ls.p);
 
+        PROFILE_COUNT(SHADOW_RAYS);
         const bool occluded = scene.anyHit(sRay, Interval(0.0f, lDist - RAY_EPSILON));
         if (!occluded) {
             const auto wo = -r.dir;
             const auto wi = ls.wi;
 
-            const auto f = evalBxdf(scene, record.material, record, wo, wi) * jtx::absdot(wi, ctx.n);
-            float pb     = pdfBxdf(scene, record.material, record, wo, wi);
+            const auto f = bsdf.evaluate(wo, wi) * jtx::absdot(wi, ctx.n);
+            float pb     = bsdf.pdf(wo, wi);
             float pl     = 1.0f / static_cast<float>(scene.lights.size()) * ls.pdf;
 
             float misWeight = 1.0f;
@@ -168,14 +181,29 @@ Vec3 sampleLights(const Ray &r, const Scene &scene, const SurfaceIntersection &r
     return {};
 }
 
-Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng) {
+// Maximum number of diffuse vertices per path written back to the radiance cache
+static constexpr int MAX_CACHE_VERTICES = 8;
+
+struct CacheVertex {
+    Vec3 p;
+    Vec3 n;
+    Vec3 beta;
+    Vec3 radiance;
+};
+
+Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng, RadianceCache *cache, RayDifferential differential, PathInfo *info) {
     Vec3 radiance = {};
     Vec3 beta     = {1, 1, 1};
     int depth     = 0;
     SurfaceIntersection record;
     LightSample lightSample;
 
-    bool hasLights = !scene.lights.empty();
+    bool hasLights     = !scene.lights.empty();
+    bool diffuseBounce = false;
+
+    CacheVertex cacheVertices[MAX_CACHE_VERTICES];
+    int numCacheVertices = 0;
+    PROFILE_COUNT(CAMERA_RAYS);
 
     while (true) {
         const bool hit = scene.closestHit(ray, Interval(0.001, INF), record);
@@ -183,6 +211,7 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
         if (!hit) {
             // Sky color is not importance sampled (for now)
             radiance += beta * scene.skyColor;
+            if (info && depth == 0) *info = {scene.skyColor, {}, 0};
             break;
         }
 
@@ -190,9 +219,28 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
         // TODO: don't support emission for now
         if (depth++ == maxDepth) break;
 
+        const bool isDiffuse = record.material->type == Material::DIFFUSE;
+        if (cache && isDiffuse) {
+            // Past the first diffuse bounce, the cached estimate replaces the rest of the path
+            Vec3 cached;
+            if (diffuseBounce && cache->lookup(record.point, record.normal, cached)) {
+                radiance += beta * cached;
+                break;
+            }
+
+            if (numCacheVertices < MAX_CACHE_VERTICES) {
+                cacheVertices[numCacheVertices++] = {record.point, record.normal, beta, radiance};
+            }
+        }
+
+        record.computeDifferentials(differential);
+        const BSDF bsdf(scene, record);
+
+        if (info && depth == 1) *info = {bsdf.albedo(), record.normal, record.t * ray.dir.len()};
+
         // Light sampling
         if (hasLights) {
-            radiance += beta * sampleLights(ray, scene, record, rng, lightSample);
+            radiance += beta * sampleLights(ray, scene, record, bsdf, rng, lightSample);
         }
 
         // BxDF sampling
@@ -201,7 +249,8 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
         const auto u2 = rng.sample<Vec2f>();
 
         BSDFSample s;
-        bool success = sampleBxdf(scene, record, wo, u, u2, s);
+        PROFILE_COUNT(BSDF_SAMPLES);
+        bool success = bsdf.sample(wo, u, u2, s);
         if (!success) break;
 
         // Update beta and set next ray
@@ -209,7 +258,26 @@ Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RN
             beta *= s.fSample * jtx::absdot(s.w_i, record.normal) / s.pdf;
         }
 
-        ray = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+        diffuseBounce |= isDiffuse && !s.isSpecular;
+
+        // Only specular bounces keep a footprint worth tracking
+        differential = s.isSpecular ? record.specularDifferential(ray, differential, s.w_i) : RayDifferential{};
+        ray          = Ray(record.point + s.w_i * RAY_EPSILON, s.w_i, record.t);
+        PROFILE_COUNT(BOUNCE_RAYS);
+    }
+    PROFILE_PATH_LENGTH(depth);
+
+    // Write back the outgoing radiance at each recorded vertex: everything gathered after the vertex, divided
+    // by the path throughput up to it
+    for (int i = 0; i < numCacheVertices; ++i) {
+        const CacheVertex &v = cacheVertices[i];
+        const Vec3 gathered  = radiance - v.radiance;
+
+        Vec3 lo;
+        for (int c = 0; c < 3; ++c) {
+            lo[c] = v.beta[c] > 0 ? gathered[c] / v.beta[c] : 0;
+        }
+        cache->record(v.p, v.n, lo);
     }
 
     return radiance;
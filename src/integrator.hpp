@@ -1,12 +1,41 @@
 #pragma once
 
+#include "radiance.hpp"
 #include "rt.hpp"
 #include "scene.hpp"
 #include "util/color.hpp"
 #include "util/rand.hpp"
 
+/**
+ * Auxiliary outputs of a path, taken at its first hit. Used to guide the denoiser.
+ */
+struct PathInfo {
+    Vec3 albedo;
+    Vec3 normal;
+    // Distance to the first hit, 0 if the path escaped
+    Float depth = 0;
+};
+
+/**
+ * Integrators a camera can render with
+ */
+enum class IntegratorType {
+    // BSDF sampling only
+    BASIC,
+    // Next event estimation with a uniformly chosen light, needs at least one light in the scene
+    PATH,
+    // MIS light sampling, the only one that reports PathInfo for the denoiser and reprojection
+    MIS,
+};
+
 Vec3 integrateBasic(Ray ray, const Scene &scene, int maxDepth, RNG &rng);
 
 Vec3 integrate(Ray ray, const Scene &scene, int maxDepth, RNG &rng);
 
-Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng);
\ No newline at end of file
+/**
+ * Path tracer with MIS light sampling
+ * @param cache Radiance cache to record into and terminate into after the first diffuse bounce, nullptr disables it
+ * @param differential Camera ray differentials used to filter texture lookups, carried through specular bounces
+ * @param info If set, receives the first-hit albedo, normal and depth
+ */
+Vec3 integrateMIS(Ray ray, const Scene &scene, int maxDepth, bool regularize, RNG &rng, RadianceCache *cache = nullptr, RayDifferential differential = {}, PathInfo *info = nullptr);
\ No newline at end of file
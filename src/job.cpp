@@ -0,0 +1,296 @@
+#include "job.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static std::string trim(const std::string &s) {
+    const auto first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    const auto last = s.find_last_not_of(" \t\r");
+    return s.substr(first, last - first + 1);
+}
+
+static bool parseBool(const std::string &value, bool &out) {
+    if (value == "true" || value == "1" || value == "on") {
+        out = true;
+        return true;
+    }
+    if (value == "false" || value == "0" || value == "off") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+// Three components separated by commas and/or spaces
+static bool parseVec3(std::string value, Vec3 &out) {
+    std::ranges::replace(value, ',', ' ');
+    size_t pos = 0;
+    for (int i = 0; i < 3; ++i) {
+        const auto start = value.find_first_not_of(' ', pos);
+        if (start == std::string::npos) return false;
+        pos = std::min(value.find(' ', start), value.size());
+        if (!parseNumber(value.substr(start, pos - start), out[i])) return false;
+    }
+    return value.find_first_not_of(' ', pos) == std::string::npos;
+}
+
+static bool parseIntegrator(const std::string &value, IntegratorType &out) {
+    if (value == "basic") out = IntegratorType::BASIC;
+    else if (value == "path") out = IntegratorType::PATH;
+    else if (value == "mis") out = IntegratorType::MIS;
+    else return false;
+    return true;
+}
+
+// Whole megabytes, stored as bytes
+static bool parseMegabytes(const std::string &value, size_t &bytes) {
+    size_t mb;
+    if (!parseNumber(value, mb) || mb > (SIZE_MAX >> 20)) return false;
+    bytes = mb << 20;
+    return true;
+}
+
+// begin:end, an empty end gives -1
+static bool parseRange(const std::string &value, int &begin, int &end) {
+    const auto colon = value.find(':');
+    if (colon == std::string::npos || !parseNumber(value.substr(0, colon), begin) || begin < 0) return false;
+
+    const std::string last = value.substr(colon + 1);
+    if (last.empty()) {
+        end = -1;
+        return true;
+    }
+    return parseNumber(last, end) && end > begin;
+}
+
+bool setJobOption(RenderJob &job, const std::string &key, const std::string &value) {
+    std::string k = key;
+    std::ranges::replace(k, '-', '_');
+
+    bool valid = true;
+    if (k == "scene") job.scene = value;
+    else if (k == "width") valid = parseNumber(value, job.width) && job.width > 0;
+    else if (k == "height") valid = parseNumber(value, job.height) && job.height > 0;
+    else if (k == "spp") valid = parseNumber(value, job.spp) && job.spp > 0;
+    else if (k == "max_depth") valid = parseNumber(value, job.maxDepth) && job.maxDepth >= 0;
+    else if (k == "clamp" || k == "max_sample_value") valid = parseNumber(value, job.maxSampleValue) && job.maxSampleValue > 0;
+    else if (k == "threads") valid = parseNumber(value, job.threads) && job.threads >= 0;
+    else if (k == "integrator") valid = parseIntegrator(value, job.integrator);
+    else if (k == "output") job.output = value;
+    else if (k == "format") valid = (job.format = value) == "auto" || value == "y4m" || value == "rgb";
+    else if (k == "denoise") valid = parseBool(value, job.denoise);
+    else if (k == "checkpoint") job.checkpoint = value;
+    else if (k == "resume") valid = parseBool(value, job.resume);
+    else if (k == "animation") job.animation = value;
+    else if (k == "tiles") valid = parseRange(value, job.tileBegin, job.tileEnd);
+    else if (k == "samples") valid = parseRange(value, job.sampleBegin, job.sampleEnd);
+    else if (k == "film") job.film = value;
+    else if (k == "heatmap") valid = parseBool(value, job.heatmap);
+    else if (k == "texture_budget") valid = parseMegabytes(value, job.textureCache.budgetBytes);
+    else if (k == "texture_cache") valid = !(job.textureCache.directory = value).empty();
+    else if (k == "center") valid = parseVec3(value, job.center.emplace());
+    else if (k == "target") valid = parseVec3(value, job.target.emplace());
+    else if (k == "fov") valid = parseNumber(value, job.yfov.emplace()) && *job.yfov > 0;
+    else {
+        std::cerr << "Unknown job setting: " << key << std::endl;
+        return false;
+    }
+
+    if (!valid) std::cerr << "Invalid value for " << key << ": " << value << std::endl;
+    return valid;
+}
+
+// A '#' starts a comment at the start of a line or after whitespace, so frame patterns like shot_####.png survive
+static std::string stripComment(const std::string &line) {
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '#' && (i == 0 || line[i - 1] == ' ' || line[i - 1] == '\t')) return line.substr(0, i);
+    }
+    return line;
+}
+
+// Splits a `key = value` line with the comment already removed
+static bool splitSetting(const std::string &line, std::string &key, std::string &value) {
+    const auto eq = line.find('=');
+    if (eq == std::string::npos) return false;
+    key   = trim(line.substr(0, eq));
+    value = trim(line.substr(eq + 1));
+    return true;
+}
+
+bool applyJobLine(RenderJob &job, const std::string &line) {
+    const std::string setting = trim(stripComment(line));
+    if (setting.empty()) return true;
+
+    std::string key, value;
+    if (!splitSetting(setting, key, value)) {
+        std::cerr << "Expected key = value: " << setting << std::endl;
+        return false;
+    }
+    return setJobOption(job, key, value);
+}
+
+// Calls apply with the key and value of every setting in a `key = value` file
+template<typename F>
+static bool readSettings(const std::string &path, const char *kind, F &&apply) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Failed to open " << kind << " file: " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = trim(stripComment(line));
+        if (line.empty()) continue;
+
+        std::string key, value;
+        if (!splitSetting(line, key, value)) {
+            std::cerr << path << ":" << number << ": expected key = value" << std::endl;
+            return false;
+        }
+        if (!apply(key, value)) {
+            std::cerr << path << ":" << number << ": invalid setting" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool loadJobFile(const std::string &path, RenderJob &job) {
+    return readSettings(path, "job", [&](const std::string &key, const std::string &value) {
+        return setJobOption(job, key, value);
+    });
+}
+
+// time; center; target[; fov]
+static bool parseKeyframe(const std::string &value, CameraKeyframe &key) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        const auto end = value.find(';', start);
+        fields.push_back(trim(value.substr(start, end == std::string::npos ? std::string::npos : end - start)));
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 4) return false;
+
+    return parseNumber(fields[0], key.time) && key.time >= 0 &&
+           parseVec3(fields[1], key.center) &&
+           parseVec3(fields[2], key.target) &&
+           (fields.size() < 4 || (parseNumber(fields[3], key.yfov) && key.yfov > 0));
+}
+
+bool loadAnimationFile(const std::string &path, Animation &animation) {
+    const bool read = readSettings(path, "animation", [&](const std::string &key, const std::string &value) {
+        if (key == "fps") return parseNumber(value, animation.fps) && animation.fps > 0;
+        if (key == "duration") return parseNumber(value, animation.duration) && animation.duration > 0;
+        if (key == "orbit") return parseNumber(value, animation.orbit);
+        if (key == "key") return parseKeyframe(value, animation.keyframes.emplace_back());
+
+        std::cerr << "Unknown animation setting: " << key << std::endl;
+        return false;
+    });
+    std::ranges::stable_sort(animation.keyframes, {}, &CameraKeyframe::time);
+    return read;
+}
+
+bool parseJobArgs(const int argc, char *argv[], RenderJob &job) {
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--job" && !loadJobFile(argv[i + 1], job)) return false;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (!arg.starts_with("--")) {
+            std::cerr << "Unexpected argument: " << arg << std::endl;
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        const std::string value = argv[++i];
+        if (arg != "--job" && !setJobOption(job, arg.substr(2), value)) return false;
+    }
+    return true;
+}
+
+std::optional<VideoStream::Format> jobStreamFormat(const RenderJob &job) {
+    if (job.format == "y4m") return VideoStream::Format::Y4M;
+    if (job.format == "rgb") return VideoStream::Format::RAW_RGB;
+
+    if (job.output == "-" || job.output.ends_with(".y4m")) return VideoStream::Format::Y4M;
+    if (job.output.ends_with(".rgb")) return VideoStream::Format::RAW_RGB;
+    return std::nullopt;
+}
+
+bool loadJobScene(const RenderJob &job, Scene &scene) {
+    if (job.scene == "shaderball") {
+        scene = createShaderBallSceneWithLight(true, job.textureCache);
+    } else if (job.scene == "knob") {
+        scene = createKnobScene(job.textureCache);
+    } else if (job.scene == "mesh") {
+        scene = createMeshScene();
+    } else {
+        if (!std::filesystem::exists(job.scene)) {
+            std::cerr << "Scene file not found: " << job.scene << std::endl;
+            return false;
+        }
+        scene = createScene(job.scene, Mat4::identity(), Vec3(0.7, 0.8, 1.0), job.textureCache);
+    }
+
+    scene.cameraProperties = jobCamera(job, scene.cameraProperties);
+    return true;
+}
+
+CameraProperties jobCamera(const RenderJob &job, CameraProperties camera) {
+    if (job.center) camera.center = *job.center;
+    if (job.target) camera.target = *job.target;
+    if (job.yfov) camera.yfov = *job.yfov;
+    return camera;
+}
+
+void applyJobSettings(const RenderJob &job, StaticCamera &camera) {
+    camera.integrator_       = job.integrator;
+    camera.maxSampleValue_   = job.maxSampleValue;
+    camera.denoise_          = job.denoise;
+    camera.checkpointPath_   = job.checkpoint;
+    camera.resume_           = job.resume;
+    camera.tileBegin_        = job.tileBegin;
+    camera.tileEnd_          = job.tileEnd;
+    camera.sampleBegin_      = job.sampleBegin;
+    camera.sampleEnd_        = job.sampleEnd;
+    camera.traversalHeatmap_ = job.heatmap;
+}
+
+bool writeJobOutput(const RenderJob &job, StaticCamera &camera) {
+    bool written;
+    if (!job.film.empty()) {
+        // A partial render only makes sense combined with the others, so it keeps the float film and sample counts
+        Checkpoint film;
+        camera.exportFilm(film);
+        written = saveCheckpoint(job.film, film);
+    } else if (const auto streamFormat = jobStreamFormat(job)) {
+        // A single frame can be streamed too, e.g. to pipe it into another tool
+        VideoStream stream;
+        written = stream.open(job.output, *streamFormat, job.width, job.height, 1) && stream.write(camera.resolveImage());
+    } else {
+        written = camera.save(job.output.c_str());
+    }
+
+    if (!written) std::cerr << "Failed to write " << (job.film.empty() ? job.output : job.film) << std::endl;
+    return written;
+}
+
+std::pair<int, int> strataForSpp(const int spp) {
+    // Largest divisor no greater than the square root
+    int x = static_cast<int>(std::sqrt(static_cast<double>(spp)));
+    while (x > 1 && spp % x != 0) --x;
+    x = std::max(x, 1);
+    return {x, spp / x};
+}
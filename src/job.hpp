@@ -0,0 +1,140 @@
+#pragma once
+
+#include "animation.hpp"
+#include "camera.hpp"
+#include "framewriter.hpp"
+#include "integrator.hpp"
+#include "scene.hpp"
+
+#include <charconv>
+#include <optional>
+#include <string>
+#include <utility>
+
+/**
+ * Settings of a headless render
+ *
+ * Job files hold one `key = value` pair per line, '#' at the start of a line or after whitespace starts a comment. The command line takes the same keys as
+ * `--key value` (dashes and underscores are interchangeable) and overrides the job file.
+ */
+struct RenderJob {
+    // Scene file to load, or one of the built-in scenes: shaderball, knob, mesh
+    std::string scene = "shaderball";
+    int width         = 800;
+    int height        = 400;
+    // Samples per pixel, split into as square a grid of strata as the count allows
+    int spp      = 64;
+    int maxDepth = 50;
+    // Per-channel clamp of each sample, inf keeps the full HDR range for EXR outputs and films
+    Float maxSampleValue = 1.0f;
+    // Scheduler worker threads, 0 uses all but one of the hardware threads
+    int threads               = 0;
+    IntegratorType integrator = IntegratorType::MIS;
+    // .png or .exr image, .y4m or .rgb video stream, "-" streams to stdout
+    std::string output = "render.png";
+    // auto, y4m or rgb. Auto streams for .y4m and .rgb outputs and stdout (as Y4M), and writes images otherwise.
+    std::string format = "auto";
+    bool denoise       = false;
+    // Checkpoint file, empty disables checkpointing
+    std::string checkpoint;
+    bool resume = false;
+    // Animation file, renders a frame sequence to output (see framePath) instead of a single image
+    std::string animation;
+
+    // Part of the render to do, as `begin:end` ranges with the end excluded and left empty for the last one. Tiles
+    // are row-major at 32 pixels, samples index into each pixel's spp.
+    int tileBegin   = 0;
+    int tileEnd     = -1;
+    int sampleBegin = 0;
+    int sampleEnd   = -1;
+    // Film file written instead of output, for JTXMerge to combine with the other parts of the render
+    std::string film;
+    // Output a heatmap of the BVH traversal work per sample instead of the render
+    bool heatmap = false;
+    // Demand-loaded texture tiles, enabled by a non-zero budget (set in MB as texture_budget, directory as texture_cache)
+    TextureCacheConfig textureCache;
+
+    // Overrides of the scene's camera
+    std::optional<Vec3> center;
+    std::optional<Vec3> target;
+    std::optional<Float> yfov;
+};
+
+/**
+ * Parses a whole string as a number, shared by the tools' command lines so they reject the same input
+ * @return False unless the entire value is a number that fits in T
+ */
+template<typename T>
+bool parseNumber(const std::string &value, T &out) {
+    const char *end   = value.data() + value.size();
+    const auto result = std::from_chars(value.data(), end, out);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+/**
+ * Sets a single job setting
+ * @param key Setting name, as used in job files
+ * @param value Setting value
+ * @return False if the key is unknown or the value can't be parsed
+ */
+bool setJobOption(RenderJob &job, const std::string &key, const std::string &value);
+
+/**
+ * Applies a single `key = value` line, as found in job files. Blank lines and comments are accepted and ignored.
+ * @return False if the line isn't a setting or setJobOption rejects it
+ */
+bool applyJobLine(RenderJob &job, const std::string &line);
+
+/**
+ * Reads a job file into job, keeping the current value of settings the file doesn't mention
+ * @return False if the file can't be read or has an invalid line
+ */
+bool loadJobFile(const std::string &path, RenderJob &job);
+
+/**
+ * Reads an animation file: `fps`, `duration` and `orbit` settings plus any number of camera keyframes, written as
+ * `key = time; center; target[; fov]`
+ * @return False if the file can't be read or has an invalid line
+ */
+bool loadAnimationFile(const std::string &path, Animation &animation);
+
+/**
+ * Applies command line options to job. A `--job <path>` option is loaded first, wherever it appears, so the other
+ * options override it.
+ * @return False on an unknown option, a missing value or a value that can't be parsed
+ */
+bool parseJobArgs(int argc, char *argv[], RenderJob &job);
+
+/**
+ * @return Video stream format the job's output is written in, empty if it is written as images
+ */
+std::optional<VideoStream::Format> jobStreamFormat(const RenderJob &job);
+
+/**
+ * Loads or builds the job's scene and applies the camera overrides. The BVH is not built.
+ * @return False if the scene file doesn't exist
+ */
+bool loadJobScene(const RenderJob &job, Scene &scene);
+
+/**
+ * @return The camera with the job's center, target and fov overrides applied
+ */
+CameraProperties jobCamera(const RenderJob &job, CameraProperties camera);
+
+/**
+ * Copies the job's render settings to the camera
+ */
+void applyJobSettings(const RenderJob &job, StaticCamera &camera);
+
+/**
+ * Writes a finished single frame render where the job asks for it: the film for partial renders, otherwise the
+ * output image or video stream
+ * @return False if the output couldn't be written
+ */
+bool writeJobOutput(const RenderJob &job, StaticCamera &camera);
+
+/**
+ * Splits a sample count into a grid of strata, as close to square as the count allows
+ * @return Strata in x and y, their product is spp
+ */
+std::pair<int, int> strataForSpp(int spp);
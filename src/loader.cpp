@@ -2,15 +2,32 @@
 
 #include "assimp/Importer.hpp"
 #include "mesh.hpp"
+#include "profile.hpp"
 #include "scene.hpp"
+#include "scheduler.hpp"
 
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <algorithm>
+#include <functional>
+#include <future>
 #include <unordered_map>
 
 static constexpr int SCENE_MATERIAL_LIMIT = 128;
 
-void loadScene(const std::string &path, Scene &scene) {
+// Texture whose decode is still in flight
+struct PendingTexture {
+    std::string name;
+    std::string key;
+    std::unique_ptr<TextureImage> texture;
+    std::future<bool> loaded;
+    ColorEncoding encoding = ColorEncoding::LINEAR;
+    bool ok                = false;
+};
+
+void loadScene(const std::string &path, Scene &scene, const TextureCacheConfig &textureCache) {
+    PROFILE_SCOPE("Load scene");
+
     // Reserve space for materials
     if (scene.materials.capacity() < SCENE_MATERIAL_LIMIT) {
         scene.materials.reserve(SCENE_MATERIAL_LIMIT);
@@ -24,6 +41,11 @@ void loadScene(const std::string &path, Scene &scene) {
         return;
     }
 
+    if (textureCache.budgetBytes > 0 && !scene.textureCache) {
+        scene.textureCache = std::make_unique<TextureCache>(textureCache);
+    }
+    TextureCache *cache = scene.textureCache.get();
+
     const size_t lastSlash = path.find_last_of("/\\");
     std::string baseDir    = (lastSlash != std::string::npos) ? path.substr(0, lastSlash + 1) : "";
 
@@ -32,7 +54,25 @@ void loadScene(const std::string &path, Scene &scene) {
     std::unordered_map<std::string, size_t> textureMap;
     std::unordered_map<std::string, size_t> materialMap;
 
-    // Load all embedded textures
+    // Textures are decoded on the scheduler as soon as they are referenced. Ids are handed out right away,
+    // so materials can point at a texture before it has finished loading.
+    const int textureBase = static_cast<int>(scene.textures.size());
+    std::vector<PendingTexture> pending;
+    Scheduler &scheduler = Scheduler::global();
+
+    auto queueTexture = [&](std::string name, std::string key, std::function<bool(TextureImage &)> decode) -> int {
+        auto &p   = pending.emplace_back();
+        p.name    = std::move(name);
+        p.key     = std::move(key);
+        p.texture = std::make_unique<TextureImage>();
+        p.loaded  = scheduler.async([&texture = *p.texture, decode = std::move(decode)] {
+            PROFILE_SCOPE("Decode texture");
+            return decode(texture);
+        });
+        return textureBase + static_cast<int>(pending.size()) - 1;
+    };
+
+    // Queue all embedded textures
     for (unsigned int i = 0; i < assimpScene->mNumTextures; ++i) {
         const aiTexture *aiTex = assimpScene->mTextures[i];
         std::string texKey     = aiTex->mFilename.C_Str();
@@ -40,25 +80,17 @@ void loadScene(const std::string &path, Scene &scene) {
             texKey = "embedded_" + std::to_string(i);
         }
 
-        TextureImage texture;
-        bool loaded = false;
-
         // This indicates a compressed texture
-        if (aiTex->mHeight == 0) {
-            loaded = texture.load(reinterpret_cast<const unsigned char *>(aiTex->pcData),
-                                  aiTex->mWidth, ImageFormat::AUTO);
-        } else {
-            loaded = texture.load(reinterpret_cast<const unsigned char *>(aiTex->pcData),
-                                  aiTex->mWidth * aiTex->mHeight * 4, ImageFormat::AUTO);
-        }
+        const size_t size = aiTex->mHeight == 0 ? aiTex->mWidth : aiTex->mWidth * aiTex->mHeight * 4;
+        const auto *data  = reinterpret_cast<const unsigned char *>(aiTex->pcData);
 
-        if (loaded) {
-            scene.textures.push_back(std::move(texture));
-            textureMap[texKey] = scene.textures.size() - 1;
-            std::cout << "Loaded embedded texture: " << texKey << std::endl;
-        } else {
-            std::cerr << "Failed to load embedded texture: " << texKey << std::endl;
-        }
+        const int texId = queueTexture(texKey, TextureCache::fileKey(path) + ":" + texKey, [data, size](TextureImage &texture) {
+            return texture.load(data, size, ImageFormat::AUTO);
+        });
+
+        // Materials refer to embedded textures by index
+        textureMap[texKey]                          = texId;
+        textureMap["embedded_" + std::to_string(i)] = texId;
     }
 
     // Lambda to load textures from materials
@@ -87,16 +119,13 @@ void loadScene(const std::string &path, Scene &scene) {
                     return textureMap[fullTexPath];
                 }
 
-                TextureImage texture;
-                if (texture.load(fullTexPath.c_str())) {
-                    scene.textures.push_back(std::move(texture));
-                    int texId               = scene.textures.size() - 1;
-                    textureMap[fullTexPath] = texId;
-                    std::cout << "Loaded texture: " << fullTexPath << std::endl;
-                    return texId;
-                }
-
-                std::cerr << "Failed to load texture: " << fullTexPath << std::endl;
+                // A previously converted tiled file lets us skip decoding altogether
+                const std::string key = TextureCache::fileKey(fullTexPath);
+                const int texId       = queueTexture(fullTexPath, key, [cache, key, fullTexPath](TextureImage &texture) {
+                    return (cache && cache->open(key, texture)) || texture.load(fullTexPath.c_str());
+                });
+                textureMap[fullTexPath] = texId;
+                return texId;
             }
         }
         return -1;
@@ -113,8 +142,12 @@ void loadScene(const std::string &path, Scene &scene) {
         if (materialMap.contains(matName)) continue;
 
         int albedoTexId = loadTexture(aiMat, aiTextureType_DIFFUSE);
+        if (albedoTexId != -1) {
+            // Albedo maps are colour data, decode them from sRGB on lookup
+            pending[albedoTexId - textureBase].encoding = ColorEncoding::SRGB;
+        }
 
-        int metallicRoughnessTexId;
+        int metallicRoughnessTexId = -1;
         float metallic             = 0.0f;
         float roughness            = 1.0f;
         bool isMetallicRoughness   = false;
@@ -144,7 +177,7 @@ void loadScene(const std::string &path, Scene &scene) {
 
         scene.materials.push_back(mat);
         materialMap[matName] = scene.materials.size() - 1;
-        std::cout << "Loaded material: " << matName << std::endl;
+        std::clog << "Loaded material: " << matName << std::endl;
     }
 
     for (unsigned int m = 0; m < assimpScene->mNumMeshes; m++) {
@@ -168,7 +201,7 @@ void loadScene(const std::string &path, Scene &scene) {
                 aiVector3D n    = aiMeshPtr->mNormals[i];
                 finalNormals[i] = Vec3(n.x, n.y, n.z);
             } else {
-                std::cout << "Missing normals" << std::endl;
+                std::clog << "Missing normals" << std::endl;
                 finalNormals[i] = Vec3(0.0f, 1.0f, 0.0f);
             }
 
@@ -221,6 +254,43 @@ void loadScene(const std::string &path, Scene &scene) {
             scene.triangles.push_back(tri);
         }
 
-        std::cout << "Loaded mesh: " << mName << std::endl;
+        std::clog << "Loaded mesh: " << mName << std::endl;
+    }
+
+    // Meshes were loaded while textures decoded. Encodings are known now, so the pyramids can be built (averaged
+    // in linear space) and handed to the cache, one task per texture as its decode completes.
+    Scheduler::TaskGroup finalize(scheduler);
+    for (auto &p : pending) {
+        p.ok = p.loaded.get();
+        if (!p.ok || p.texture->cached()) continue;
+
+        finalize.run([&p, cache] {
+            p.texture->setEncoding(p.encoding);
+            p.texture->buildMipmaps();
+            if (cache) cache->add(p.key, *p.texture);
+        });
+    }
+    finalize.wait();
+
+    std::vector<bool> failed(pending.size(), false);
+    for (size_t i = 0; i < pending.size(); ++i) {
+        auto &p = pending[i];
+        if (p.ok) {
+            std::clog << "Loaded texture: " << p.name << std::endl;
+        } else {
+            std::cerr << "Failed to load texture: " << p.name << std::endl;
+            failed[i] = true;
+        }
+        scene.textures.push_back(std::move(*p.texture));
+    }
+
+    // Materials referencing a texture that failed to decode fall back to their constant values
+    auto resolve = [&](int &texId) {
+        const int i = texId - textureBase;
+        if (i >= 0 && i < static_cast<int>(failed.size()) && failed[i]) texId = -1;
+    };
+    for (auto &mat : scene.materials) {
+        resolve(mat.albedoTexId);
+        resolve(mat.metallicRoughnessTexId);
     }
-}
\ No newline at end of file
+}
@@ -1,6 +1,12 @@
 #pragma once
+#include "texcache.hpp"
+
 #include <string>
 
 struct Scene;
 
-void loadScene(const std::string &path, Scene &scene);
\ No newline at end of file
+/**
+ * Loads meshes, materials and textures from a model file into the scene
+ * @param textureCache With a non-zero budget, textures are converted to tiled files and loaded on demand
+ */
+void loadScene(const std::string &path, Scene &scene, const TextureCacheConfig &textureCache = {});
\ No newline at end of file
@@ -3,19 +3,28 @@
 #include "bvh.hpp"
 #include "camera.hpp"
 #include "display.hpp"
+#include "job.hpp"
 #include "scene.hpp"
+#include "scheduler.hpp"
 
+#include <iostream>
 #include <thread>
 
-// Camera Settings
-constexpr int IMAGE_WIDTH  = 800;
-constexpr int IMAGE_HEIGHT = 400;
-constexpr int MAX_DEPTH    = 50;
-
 int main(int argc, char *argv[]) {
+    // Takes the headless job settings, of which the scene, image size, samples, depth, threads and texture cache
+    // apply here. The defaults are the initial render settings of the UI.
+    RenderJob job;
+    if (!parseJobArgs(argc, argv, job)) {
+        std::cerr << "Usage: " << argv[0] << " [--job <file>] [--<setting> <value>]..., see JTXHeadless --help" << std::endl;
+        return 1;
+    }
+
+    // Leave a core to the UI, the thread driving a render works alongside the scheduler's workers
     const int threadCapacity = std::thread::hardware_concurrency();
+    Scheduler::setGlobalThreadCount(job.threads > 0 ? job.threads : threadCapacity - 2);
 
-    Scene scene = createShaderBallSceneWithLight(true);
+    Scene scene;
+    if (!loadJobScene(job, scene)) return 1;
 
     // Scene scene = createScene("assets/scenes/helmet.glb", Mat4::identity(), Color::BLACK);
     //
@@ -34,17 +43,25 @@ int main(int argc, char *argv[]) {
 
     scene.buildBVH();
 
-#ifndef DISABLE_UI
+    const auto [xSamples, ySamples] = strataForSpp(job.spp);
     StaticCamera camera{
-            IMAGE_WIDTH,
-            IMAGE_HEIGHT,
+            job.width,
+            job.height,
+            scene.cameraProperties,
+            xSamples,
+            ySamples,
+            job.maxDepth};
+
+    // Drives the viewport in interactive mode, mirroring the static camera's settings
+    DynamicCamera dynamicCamera{
+            job.width,
+            job.height,
             scene.cameraProperties,
-            8,
-            8,
-            MAX_DEPTH,
-            threadCapacity - 2};
+            xSamples,
+            ySamples,
+            job.maxDepth};
 
-    Display display(IMAGE_WIDTH + SIDEBAR_WIDTH, IMAGE_HEIGHT, &camera);
+    Display display(job.width + SIDEBAR_WIDTH, job.height, &camera, &dynamicCamera);
     if (!display.init()) {
         return -1;
     }
@@ -58,50 +75,12 @@ int main(int argc, char *argv[]) {
         std::this_thread::sleep_for(std::chrono::milliseconds(16));
     }
 
+    dynamicCamera.stopRender();
     while (display.isRendering()) {
         std::this_thread::sleep_for(std::chrono::milliseconds(16));
     }
 
     display.destroy();
-#else
-    // Render the scene in orbit over 5 seconds @ 30 FPS
-    constexpr int FPS           = 30;
-    constexpr int NUM_FRAMES    = 5 * FPS;
-    constexpr float TOTAL_ANGLE = 2 * PI;
-    constexpr float DELTA_ANGLE = TOTAL_ANGLE / NUM_FRAMES;
-
-    Camera camera{
-            1920,
-            1080,
-            scene.cameraProperties,
-            32,
-            32,
-            MAX_DEPTH};
-
-    Vec3 offset = camera.properties_.center - camera.properties_.target;
-
-    for (int frame = 0; frame < NUM_FRAMES; ++frame) {
-        const float angle = frame * DELTA_ANGLE;
-
-        const float cosTheta = jtx::cos(angle);
-        const float sinTheta = jtx::sin(angle);
-
-        const float x = offset.x * cosTheta - offset.z * sinTheta;
-        const float z = offset.x * sinTheta + offset.z * cosTheta;
-        Vec3 rotation{x, offset.y, z};
-
-        camera.properties_.center = camera.properties_.target + rotation;
-
-        std::cout << "Rendering frame: " << frame << std::endl;
-        camera.render(scene);
-        std::string path = "frame_" + std::to_string(frame) + ".png";
-        camera.save(path.c_str());
-        std::cout << "Saved frame: " << path << std::endl;
-    }
-
-    std::cout << "Finished rendering" << std::endl;
-
-#endif
 
     scene.destroy();
     return 0;
@@ -2,6 +2,8 @@
 
 #include "util/color.hpp"
 
+#include <cmath>
+
 struct Material {
     enum Type {
         DIFFUSE = 0,
@@ -22,6 +24,26 @@ struct Material {
     int metallicRoughnessTexId;
 };
 
+/**
+ * Offset rays one pixel over in x and y, used to estimate texture footprints.
+ * Carried from the camera through specular bounces, dropped after the first non-specular one.
+ */
+struct RayDifferential {
+    bool hasDifferentials = false;
+    Vec3 rxOrigin, ryOrigin;
+    Vec3 rxDir, ryDir;
+
+    /**
+     * Scales the offsets around the main ray, used to shrink footprints when taking several samples per pixel
+     */
+    void scale(const Ray &r, const Float s) {
+        rxOrigin = r.origin + (rxOrigin - r.origin) * s;
+        ryOrigin = r.origin + (ryOrigin - r.origin) * s;
+        rxDir    = r.dir + (rxDir - r.dir) * s;
+        ryDir    = r.dir + (ryDir - r.dir) * s;
+    }
+};
+
 struct SurfaceIntersection {
     Vec3 point;
     Vec3 normal;
@@ -29,6 +51,13 @@ struct SurfaceIntersection {
     Vec3 tangent;
     Vec3 bitangent;
 
+    // Surface partial derivatives
+    Vec3 dpdu, dpdv;
+
+    // Screen-space differentials, zero unless computeDifferentials() found ray differentials
+    Vec3 dpdx, dpdy;
+    Float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
+
     const Material *material;
     Float t;
     bool frontFace;
@@ -37,4 +66,93 @@ struct SurfaceIntersection {
         frontFace = jtx::dot(r.dir, n) < 0;
         normal    = frontFace ? n : -n;
     }
+
+    /**
+     * Estimates screen-space position and UV differentials by intersecting the offset rays with the tangent plane
+     * See: https://pbr-book.org/3ed-2018/Texture/Sampling_and_Antialiasing#FindingtheTextureSamplingRate
+     * @param rd Ray differentials of the ray that produced this intersection
+     */
+    void computeDifferentials(const RayDifferential &rd) {
+        dudx = dvdx = dudy = dvdy = 0;
+        dpdx = dpdy = Vec3(0, 0, 0);
+        if (!rd.hasDifferentials) return;
+
+        const Float d      = jtx::dot(normal, point);
+        const Float denomX = jtx::dot(normal, rd.rxDir);
+        const Float denomY = jtx::dot(normal, rd.ryDir);
+        if (denomX == 0 || denomY == 0) return;
+
+        const Float tx = -(jtx::dot(normal, rd.rxOrigin) - d) / denomX;
+        const Float ty = -(jtx::dot(normal, rd.ryOrigin) - d) / denomY;
+        if (!std::isfinite(tx) || !std::isfinite(ty)) return;
+
+        dpdx = rd.rxOrigin + tx * rd.rxDir - point;
+        dpdy = rd.ryOrigin + ty * rd.ryDir - point;
+
+        // Project onto the two axes where the normal is smallest and solve the 2x2 system
+        int dim[2];
+        if (jtx::abs(normal.x) > jtx::abs(normal.y) && jtx::abs(normal.x) > jtx::abs(normal.z)) {
+            dim[0] = 1;
+            dim[1] = 2;
+        } else if (jtx::abs(normal.y) > jtx::abs(normal.z)) {
+            dim[0] = 0;
+            dim[1] = 2;
+        } else {
+            dim[0] = 0;
+            dim[1] = 1;
+        }
+
+        const Float a00 = dpdu[dim[0]], a01 = dpdv[dim[0]];
+        const Float a10 = dpdu[dim[1]], a11 = dpdv[dim[1]];
+        const Float det = a00 * a11 - a01 * a10;
+        if (jtx::abs(det) < 1e-12f) return;
+        const Float invDet = 1 / det;
+
+        dudx = (a11 * dpdx[dim[0]] - a01 * dpdx[dim[1]]) * invDet;
+        dvdx = (a00 * dpdx[dim[1]] - a10 * dpdx[dim[0]]) * invDet;
+        dudy = (a11 * dpdy[dim[0]] - a01 * dpdy[dim[1]]) * invDet;
+        dvdy = (a00 * dpdy[dim[1]] - a10 * dpdy[dim[0]]) * invDet;
+
+        if (!std::isfinite(dudx)) dudx = 0;
+        if (!std::isfinite(dvdx)) dvdx = 0;
+        if (!std::isfinite(dudy)) dudy = 0;
+        if (!std::isfinite(dvdy)) dvdy = 0;
+    }
+
+    /**
+     * @return Width of the texture filter footprint in UV space
+     */
+    [[nodiscard]] Float uvFootprint() const {
+        return 2 * jtx::max(jtx::max(jtx::abs(dudx), jtx::abs(dudy)), jtx::max(jtx::abs(dvdx), jtx::abs(dvdy)));
+    }
+
+    /**
+     * Computes the ray differentials of a specularly scattered ray.
+     * Reflection follows PBRT (with flat shading normals), transmission keeps the incident angular spread.
+     * @param r Incident ray
+     * @param rd Incident ray differentials
+     * @param w_i Scattered direction
+     * @return Differentials of the scattered ray
+     */
+    [[nodiscard]] RayDifferential specularDifferential(const Ray &r, const RayDifferential &rd, const Vec3 &w_i) const {
+        RayDifferential out;
+        if (!rd.hasDifferentials) return out;
+
+        out.hasDifferentials = true;
+        out.rxOrigin         = point + dpdx;
+        out.ryOrigin         = point + dpdy;
+
+        const Vec3 w_o      = -normalize(r.dir);
+        const bool transmit = jtx::dot(w_o, normal) * jtx::dot(w_i, normal) < 0;
+        if (transmit) {
+            out.rxDir = w_i + (normalize(rd.rxDir) + w_o);
+            out.ryDir = w_i + (normalize(rd.ryDir) + w_o);
+        } else {
+            const Vec3 dwodx = -normalize(rd.rxDir) - w_o;
+            const Vec3 dwody = -normalize(rd.ryDir) - w_o;
+            out.rxDir        = w_i - dwodx + 2 * jtx::dot(dwodx, normal) * normal;
+            out.ryDir        = w_i - dwody + 2 * jtx::dot(dwody, normal) * normal;
+        }
+        return out;
+    }
 };
@@ -0,0 +1,71 @@
+#include "checkpoint.hpp"
+#include "image.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " <output> <film>...\n"
+              << "\n"
+              << "Combines the films of a render split across processes with the headless renderer's tiles and\n"
+              << "samples settings. Each pixel is averaged over all the samples the films hold for it.\n"
+              << "\n"
+              << "  output  .exr for the float image, .png for the 8-bit one, anything else for a merged film\n"
+              << "  film    Film files written with the film setting\n";
+}
+
+// Resolves the merged film tile by tile, each at its own sample count
+static bool saveImage(const std::string &path, const Checkpoint &film) {
+    AccumulationBuffer acc(film.width, film.height);
+    film.restore(acc, nullptr);
+
+    if (path.ends_with(".exr") || path.ends_with(".EXR")) return acc.saveEXR(path.c_str(), film.tileSamples, film.tileSize);
+
+    RGB8Image img(film.width, film.height);
+    const int tilesX = (film.width + film.tileSize - 1) / film.tileSize;
+    for (size_t i = 0; i < film.tileSamples.size(); ++i) {
+        const int startRow = static_cast<int>(i) / tilesX * film.tileSize;
+        const int startCol = static_cast<int>(i) % tilesX * film.tileSize;
+        const int endRow   = std::min(startRow + film.tileSize, film.height);
+        const int endCol   = std::min(startCol + film.tileSize, film.width);
+        img.resolve(acc, 1.0f / static_cast<Float>(std::max(film.tileSamples[i], 1)), startRow, startCol, endRow, endCol);
+    }
+    return img.save(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3 || std::strcmp(argv[1], "--help") == 0 || std::strcmp(argv[1], "-h") == 0) {
+        printUsage(argv[0]);
+        return argc < 3 ? 1 : 0;
+    }
+
+    const std::string output = argv[1];
+    Checkpoint merged;
+    for (int i = 2; i < argc; ++i) {
+        Checkpoint partial;
+        if (!loadCheckpoint(argv[i], partial)) {
+            std::cerr << "Failed to read film: " << argv[i] << std::endl;
+            return 1;
+        }
+        if (!mergeFilm(merged, partial)) {
+            std::cerr << "Film does not match the others (size, tiling, spp, clamp or scene): " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    // Not fatal, the parts may simply not all be done yet
+    const auto missing = std::ranges::count(merged.tileSamples, 0);
+    if (missing > 0) std::cerr << missing << " of " << merged.tileSamples.size() << " tiles have no samples" << std::endl;
+
+    const auto [minSamples, maxSamples] = std::ranges::minmax(merged.tileSamples);
+    if (minSamples != maxSamples) std::cerr << "Tiles have between " << minSamples << " and " << maxSamples << " samples" << std::endl;
+
+    const bool isImage = output.ends_with(".exr") || output.ends_with(".EXR") || output.ends_with(".png") || output.ends_with(".PNG");
+    if (!(isImage ? saveImage(output, merged) : saveCheckpoint(output, merged))) {
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Merged " << argc - 2 << " films into " << output << std::endl;
+    return 0;
+}
@@ -97,6 +97,14 @@ struct Mesh {
     }
 
     void getUVs(const int index, Vec2f &uv0, Vec2f &uv1, Vec2f &uv2) const {
+        if (!uvs) {
+            // Default parameterization, see PBRT's Triangle::InteractionFromIntersection
+            uv0 = {0, 0};
+            uv1 = {1, 0};
+            uv2 = {1, 1};
+            return;
+        }
+
         const Vec3i i = indices[index];
         uv0           = uvs[i[0]];
         uv1           = uvs[i[1]];
@@ -144,23 +152,25 @@ struct Mesh {
         getUVs(index, uv0, uv1, uv2);
         record.uv = uv0 * b0 + uv1 * b1 + uv2 * b2;
 
-        // Tangent & bitangent
-        // TODO: fix this
-        // Taken from:
-        //  - https://github.com/knightcrawler25/GLSL-PathTracer/blob/master/src/shaders/common/closest_hit.glsl
-        // We don't support textures yet, so we will use UVs as specified here:
-        //  - https://pbr-book.org/4ed/Shapes/Triangle_Meshes#fragment-Computedeltasandmatrixdeterminantfortrianglepartialderivatives-0
-        // This should be changed to using mesh UV values if available
-        // const Vec3 dp1 = v1 - v0;
-        // const Vec3 dp2 = v2 - v0;
-        //
-        // const Vec2f duv1 = uv1 - uv0;
-        // const Vec2f duv2 = uv2 - uv0;
-        //
-        // float duvInvDet = 1.0f / (duv1.x * duv2.y - duv1.y * duv2.x);
-        //
-        // record.tangent   = jtx::normalize((duv2.y * dp1 - duv1.y * dp2) * duvInvDet);
-        // record.bitangent = jtx::normalize((duv1.x * dp2 - duv2.x * dp1) * duvInvDet);
+        // Position partial derivatives, used to map ray differentials into UV space
+        // See: https://pbr-book.org/4ed/Shapes/Triangle_Meshes#fragment-Computedeltasandmatrixdeterminantfortrianglepartialderivatives-0
+        const Vec2f duv02 = uv0 - uv2;
+        const Vec2f duv12 = uv1 - uv2;
+        const Vec3 dp02   = v0 - v2;
+        const Vec3 dp12   = v1 - v2;
+        const float uvDet = duv02.x * duv12.y - duv02.y * duv12.x;
+
+        if (fabs(uvDet) < 1e-9f) {
+            // Degenerate UVs, any frame around the geometric normal will do
+            const Vec3 ng   = jtx::normalize(jtx::cross(v0v1, v0v2));
+            const Vec3 axis = fabs(ng.x) > 0.9f ? Vec3(0, 1, 0) : Vec3(1, 0, 0);
+            record.dpdu     = jtx::normalize(jtx::cross(axis, ng));
+            record.dpdv     = jtx::cross(ng, record.dpdu);
+        } else {
+            const float invUVDet = 1 / uvDet;
+            record.dpdu          = (duv12.y * dp02 - duv02.y * dp12) * invUVDet;
+            record.dpdv          = (duv02.x * dp12 - duv12.x * dp02) * invUVDet;
+        }
 
         return true;
     }
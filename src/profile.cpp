@@ -0,0 +1,184 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+ProfileReport ProfileReport::operator-(const ProfileReport &other) const {
+    ProfileReport result;
+    for (size_t i = 0; i < PROFILE_COUNTERS; ++i) result.counters[i] = counters[i] - other.counters[i];
+    for (size_t i = 0; i < PATH_LENGTH_BUCKETS; ++i) result.pathLengths[i] = pathLengths[i] - other.pathLengths[i];
+    result.seconds = seconds - other.seconds;
+    return result;
+}
+
+const char *profileCounterName(const ProfileCounter counter) {
+    switch (counter) {
+        case ProfileCounter::CAMERA_RAYS:
+            return "Camera rays";
+        case ProfileCounter::BOUNCE_RAYS:
+            return "Bounce rays";
+        case ProfileCounter::SHADOW_RAYS:
+            return "Shadow rays";
+        case ProfileCounter::BVH_NODES:
+            return "BVH nodes visited";
+        case ProfileCounter::TRIANGLE_TESTS:
+            return "Triangles tested";
+        case ProfileCounter::BSDF_SAMPLES:
+            return "BSDF samples";
+        default:
+            return "";
+    }
+}
+
+#ifdef ENABLE_PROFILING
+
+// Blocks of every thread that has counted anything, kept after the thread exits so totals never go backwards.
+// Never destroyed, threads still running at exit may register or record into it.
+struct ProfileRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadProfile>> profiles;
+};
+
+static ProfileRegistry &registry() {
+    static auto *instance = new ProfileRegistry;
+    return *instance;
+}
+
+ThreadProfile *registerThreadProfile() {
+    ProfileRegistry &r = registry();
+    std::lock_guard lock(r.mutex);
+    return r.profiles.emplace_back(std::make_unique<ThreadProfile>()).get();
+}
+
+ProfileReport profileSnapshot() {
+    ProfileReport report;
+    ProfileRegistry &r = registry();
+    std::lock_guard lock(r.mutex);
+    for (const auto &profile : r.profiles) {
+        for (size_t i = 0; i < PROFILE_COUNTERS; ++i) report.counters[i] += profile->counters[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < PATH_LENGTH_BUCKETS; ++i) report.pathLengths[i] += profile->pathLengths[i].load(std::memory_order_relaxed);
+    }
+    return report;
+}
+
+int64_t traceClock() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// Where the trace goes at exit, from JTX_TRACE. Without it neither the file nor the zones are written.
+// Never destroyed, TraceDump reads it after function statics have gone.
+static const std::string &tracePath() {
+    static const auto *path = [] {
+        const char *env = std::getenv("JTX_TRACE");
+        return new std::string(env ? env : "");
+    }();
+    return *path;
+}
+
+void ThreadProfile::trace(const char *name, const int64_t begin, const int64_t end) {
+    if (tracePath().empty()) return;
+    if (!traceTail_ || traceTail_->count.load(std::memory_order_relaxed) == TraceChunk::SIZE) {
+        if ((traceChunks_ + 1) * TraceChunk::SIZE > TRACE_EVENT_LIMIT) return;
+
+        // Linked in empty, the count publishes each event once it is written
+        auto *chunk = new TraceChunk;
+        if (traceTail_) {
+            traceTail_->next.store(chunk, std::memory_order_release);
+        } else {
+            traceHead.store(chunk, std::memory_order_release);
+        }
+        traceTail_ = chunk;
+        ++traceChunks_;
+    }
+
+    const uint32_t index      = traceTail_->count.load(std::memory_order_relaxed);
+    traceTail_->events[index] = {name, begin, end};
+    traceTail_->count.store(index + 1, std::memory_order_release);
+}
+
+// First chunk of each thread's timeline, null for threads that have recorded nothing
+static std::vector<TraceChunk *> traceHeads() {
+    std::vector<TraceChunk *> heads;
+    ProfileRegistry &r = registry();
+    std::lock_guard lock(r.mutex);
+    for (const auto &profile : r.profiles) heads.push_back(profile->traceHead.load(std::memory_order_acquire));
+    return heads;
+}
+
+bool writeProfileTrace(const std::string &path) {
+    const auto heads = traceHeads();
+    std::ofstream out(path);
+    if (!out) return false;
+    out << std::fixed << std::setprecision(3);
+
+    // Complete events in microseconds, one timeline row per registered thread
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (size_t tid = 0; tid < heads.size(); ++tid) {
+        for (const TraceChunk *chunk = heads[tid]; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            const uint32_t count = chunk->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; ++i) {
+                const TraceEvent &event = chunk->events[i];
+                out << (first ? "\n" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << tid
+                    << ", \"ts\": " << static_cast<double>(event.begin) / 1e3 << ", \"dur\": " << static_cast<double>(event.end - event.begin) / 1e3 << "}";
+                first = false;
+            }
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+// Constructed before main, so it is destroyed after the global scheduler has joined its workers
+static struct TraceDump {
+    ~TraceDump() {
+        const std::string &path = tracePath();
+        if (path.empty() || std::ranges::none_of(traceHeads(), [](const TraceChunk *head) { return head != nullptr; })) return;
+
+        if (writeProfileTrace(path)) {
+            std::clog << "Wrote trace to " << path << std::endl;
+        } else {
+            std::cerr << "Failed to write trace: " << path << std::endl;
+        }
+    }
+} traceDump;
+
+#else
+
+ProfileReport profileSnapshot() { return {}; }
+
+bool writeProfileTrace(const std::string &) { return false; }
+
+#endif
+
+void printProfileReport(const ProfileReport &report, std::ostream &out) {
+    const auto flags = out.flags();
+    out << std::fixed << std::setprecision(2);
+
+    out << "Profile (" << report.seconds << "s):\n";
+    for (size_t i = 0; i < PROFILE_COUNTERS; ++i) {
+        out << "  " << std::left << std::setw(20) << profileCounterName(static_cast<ProfileCounter>(i)) << std::right << std::setw(16) << report.counters[i] << "\n";
+    }
+
+    const uint64_t rays = report.rays();
+    if (rays > 0) {
+        const auto perRay = [&](const ProfileCounter counter) { return static_cast<double>(report[counter]) / static_cast<double>(rays); };
+        out << "  Per ray: " << perRay(ProfileCounter::BVH_NODES) << " nodes, " << perRay(ProfileCounter::TRIANGLE_TESTS) << " triangles\n";
+        if (report.seconds > 0) out << "  " << static_cast<double>(rays) / report.seconds / 1e6 << " Mrays/s\n";
+    }
+
+    out << "  Path lengths:";
+    for (size_t i = 0; i < PATH_LENGTH_BUCKETS; ++i) {
+        out << " " << report.pathLengths[i] << (i + 1 == PATH_LENGTH_BUCKETS ? "+" : "");
+    }
+    out << std::endl;
+    out.flags(flags);
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * Hot path counters
+ *
+ * Each thread counts into its own cache-line aligned block, so counting never contends or shares a line with
+ * another thread, and the blocks are only summed when a report is taken. Without ENABLE_PROFILING the macros
+ * compile to nothing.
+ */
+enum class ProfileCounter {
+    CAMERA_RAYS,
+    BOUNCE_RAYS,
+    SHADOW_RAYS,
+    BVH_NODES,
+    TRIANGLE_TESTS,
+    BSDF_SAMPLES,
+    COUNT
+};
+
+static constexpr size_t PROFILE_COUNTERS = static_cast<size_t>(ProfileCounter::COUNT);
+// Paths of this many bounces or more share the last bucket
+static constexpr size_t PATH_LENGTH_BUCKETS = 16;
+
+/**
+ * Counter totals over all threads, or the difference between two of them
+ */
+struct ProfileReport {
+    std::array<uint64_t, PROFILE_COUNTERS> counters{};
+    // Number of paths by how many surfaces they hit before terminating
+    std::array<uint64_t, PATH_LENGTH_BUCKETS> pathLengths{};
+    // Wall time the report covers, set by whoever takes it
+    double seconds = 0;
+
+    uint64_t operator[](ProfileCounter counter) const { return counters[static_cast<size_t>(counter)]; }
+
+    [[nodiscard]] uint64_t rays() const {
+        return (*this)[ProfileCounter::CAMERA_RAYS] + (*this)[ProfileCounter::BOUNCE_RAYS] + (*this)[ProfileCounter::SHADOW_RAYS];
+    }
+
+    ProfileReport operator-(const ProfileReport &other) const;
+};
+
+const char *profileCounterName(ProfileCounter counter);
+
+/**
+ * @return Sum of every thread's counters since the start of the program, all zero without ENABLE_PROFILING
+ */
+ProfileReport profileSnapshot();
+
+/**
+ * Writes the counters, the per-ray averages and the path length histogram
+ */
+void printProfileReport(const ProfileReport &report, std::ostream &out);
+
+/**
+ * Timeline zones
+ *
+ * PROFILE_SCOPE records when the enclosing block starts and ends on the calling thread. Events go into the
+ * thread's own buffer without locking, and every thread's events are written as a Chrome trace (chrome://tracing
+ * or Perfetto) when the program exits, to the path in JTX_TRACE. Zones are only recorded while JTX_TRACE is set
+ * to a path, and without ENABLE_PROFILING nothing is recorded at all.
+ */
+struct TraceEvent {
+    // Zone names are string literals, so the pointer stays valid for the lifetime of the program
+    const char *name;
+    // Nanoseconds since the first event of the program
+    int64_t begin;
+    int64_t end;
+};
+
+/**
+ * Writes every event recorded so far as Chrome trace JSON
+ * @return False if the file couldn't be written, or if profiling is disabled
+ */
+bool writeProfileTrace(const std::string &path);
+
+#ifdef ENABLE_PROFILING
+
+/**
+ * Fixed block of events. Blocks are never moved or freed, so a reader can walk them while the owner appends.
+ */
+struct TraceChunk {
+    static constexpr uint32_t SIZE = 4096;
+
+    TraceEvent events[SIZE];
+    // Events up to count are complete, published with release by the owning thread
+    std::atomic<uint32_t> count    = 0;
+    std::atomic<TraceChunk *> next = nullptr;
+};
+
+struct alignas(64) ThreadProfile {
+    // Only the owning thread writes, so a plain load and store is enough, the atomics just make reports safe
+    std::atomic<uint64_t> counters[PROFILE_COUNTERS]       = {};
+    std::atomic<uint64_t> pathLengths[PATH_LENGTH_BUCKETS] = {};
+
+    void add(ProfileCounter counter, const uint64_t n) { increment(counters[static_cast<size_t>(counter)], n); }
+
+    void addPathLength(const int length) {
+        increment(pathLengths[length < static_cast<int>(PATH_LENGTH_BUCKETS) ? length : PATH_LENGTH_BUCKETS - 1], 1);
+    }
+
+    /**
+     * Appends a zone to the thread's timeline, dropping it once the thread has recorded TRACE_EVENT_LIMIT events
+     */
+    void trace(const char *name, int64_t begin, int64_t end);
+
+    std::atomic<TraceChunk *> traceHead = nullptr;
+
+private:
+    // Per thread cap, so a long interactive session can't grow the timeline without bound
+    static constexpr size_t TRACE_EVENT_LIMIT = 1 << 18;
+
+    TraceChunk *traceTail_ = nullptr;
+    size_t traceChunks_    = 0;
+
+    static void increment(std::atomic<uint64_t> &value, const uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Allocates and registers a block for the calling thread, called once per thread
+ */
+ThreadProfile *registerThreadProfile();
+
+inline ThreadProfile &threadProfile() {
+    thread_local ThreadProfile *profile = registerThreadProfile();
+    return *profile;
+}
+
+/**
+ * Counts BVH traversal steps in registers and adds them to the thread's block once the traversal returns
+ */
+struct TraversalCounter {
+    uint64_t nodes     = 0;
+    uint64_t triangles = 0;
+
+    void node() { ++nodes; }
+    void triangle() { ++triangles; }
+
+    ~TraversalCounter() {
+        ThreadProfile &profile = threadProfile();
+        profile.add(ProfileCounter::BVH_NODES, nodes);
+        profile.add(ProfileCounter::TRIANGLE_TESTS, triangles);
+    }
+};
+
+/**
+ * @return Nanoseconds on the trace clock, which starts at the first call
+ */
+int64_t traceClock();
+
+/**
+ * Records the lifetime of the scope as a zone on the calling thread
+ */
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name) : name_(name), begin_(traceClock()) {}
+    ~ProfileScope() { threadProfile().trace(name_, begin_, traceClock()); }
+
+    ProfileScope(const ProfileScope &)            = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    const char *name_;
+    int64_t begin_;
+};
+
+#define PROFILE_ADD(counter, n) threadProfile().add(ProfileCounter::counter, n)
+#define PROFILE_PATH_LENGTH(length) threadProfile().addPathLength(length)
+#define PROFILE_SCOPE_JOIN(a, b) a##b
+#define PROFILE_SCOPE_VARIABLE(line) PROFILE_SCOPE_JOIN(profileScope, line)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_SCOPE_VARIABLE(__LINE__)(name)
+
+#else
+
+struct TraversalCounter {
+    void node() {}
+    void triangle() {}
+};
+
+#define PROFILE_ADD(counter, n) ((void) 0)
+#define PROFILE_PATH_LENGTH(length) ((void) 0)
+#define PROFILE_SCOPE(name) ((void) 0)
+
+#endif
+
+#define PROFILE_COUNT(counter) PROFILE_ADD(counter, 1)
@@ -0,0 +1,100 @@
+#include "radiance.hpp"
+#include "util/hash.hpp"
+
+#include <bit>
+
+// Key 0 marks an empty slot
+static constexpr uint64_t EMPTY_KEY = 0;
+
+// Each normal component is quantized to this many buckets
+static constexpr int NORMAL_BUCKETS = 3;
+
+RadianceCache::RadianceCache(const size_t capacity, const int minSamples, const Float maxRadiance)
+    : capacity_(std::bit_ceil(capacity)),
+      minSamples_(minSamples),
+      maxRadiance_(maxRadiance) {}
+
+void RadianceCache::clear(const Float cellSize) {
+    if (!entries_) {
+        entries_ = std::make_unique<Entry[]>(capacity_);
+    }
+
+    invCellSize_ = 1.0f / cellSize;
+    for (size_t i = 0; i < capacity_; ++i) {
+        entries_[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+        entries_[i].r.store(0, std::memory_order_relaxed);
+        entries_[i].g.store(0, std::memory_order_relaxed);
+        entries_[i].b.store(0, std::memory_order_relaxed);
+        entries_[i].count.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t RadianceCache::key(const Vec3 &p, const Vec3 &n) const {
+    const int x = static_cast<int>(std::floor(p.x * invCellSize_));
+    const int y = static_cast<int>(std::floor(p.y * invCellSize_));
+    const int z = static_cast<int>(std::floor(p.z * invCellSize_));
+
+    // Pack the quantized normal into a single integer
+    int normalKey = 0;
+    for (int i = 0; i < 3; ++i) {
+        const int b = jtx::clamp(static_cast<int>((n[i] * 0.5f + 0.5f) * NORMAL_BUCKETS), 0, NORMAL_BUCKETS - 1);
+        normalKey   = normalKey * NORMAL_BUCKETS + b;
+    }
+
+    const uint64_t h = hash(x, y, z, normalKey);
+    return h == EMPTY_KEY ? 1 : h;
+}
+
+void RadianceCache::record(const Vec3 &p, const Vec3 &n, const Vec3 &radiance) {
+    if (!entries_) return;
+
+    const uint64_t k  = key(p, n);
+    const size_t mask = capacity_ - 1;
+
+    for (int i = 0; i < MAX_PROBES; ++i) {
+        Entry &e = entries_[(k + i) & mask];
+
+        uint64_t current = e.key.load(std::memory_order_relaxed);
+        if (current == EMPTY_KEY) {
+            // Claim the slot. If another thread beats us to it, current is updated to their key.
+            e.key.compare_exchange_strong(current, k, std::memory_order_relaxed);
+            if (current == EMPTY_KEY) current = k;
+        }
+
+        if (current == k) {
+            e.r.fetch_add(jtx::min(radiance.r, maxRadiance_), std::memory_order_relaxed);
+            e.g.fetch_add(jtx::min(radiance.g, maxRadiance_), std::memory_order_relaxed);
+            e.b.fetch_add(jtx::min(radiance.b, maxRadiance_), std::memory_order_relaxed);
+            e.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    // No free slot within the probe window, drop the sample
+}
+
+bool RadianceCache::lookup(const Vec3 &p, const Vec3 &n, Vec3 &radiance) const {
+    if (!entries_) return false;
+
+    const uint64_t k  = key(p, n);
+    const size_t mask = capacity_ - 1;
+
+    for (int i = 0; i < MAX_PROBES; ++i) {
+        const Entry &e         = entries_[(k + i) & mask];
+        const uint64_t current = e.key.load(std::memory_order_relaxed);
+        if (current == EMPTY_KEY) return false;
+        if (current != k) continue;
+
+        const uint32_t count = e.count.load(std::memory_order_relaxed);
+        if (count < static_cast<uint32_t>(minSamples_)) return false;
+
+        const float invCount = 1.0f / static_cast<float>(count);
+        radiance             = Vec3(e.r.load(std::memory_order_relaxed), e.g.load(std::memory_order_relaxed), e.b.load(std::memory_order_relaxed)) * invCount;
+        return true;
+    }
+
+    return false;
+}
+
+size_t RadianceCache::memoryUsage() const {
+    return entries_ ? capacity_ * sizeof(Entry) : 0;
+}
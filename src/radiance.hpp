@@ -0,0 +1,73 @@
+#pragma once
+
+#include "rt.hpp"
+
+#include <atomic>
+#include <memory>
+
+/**
+ * World-space radiance cache
+ *
+ * Fixed-capacity hash grid keyed by quantized position and normal. Diffuse path vertices write their
+ * outgoing radiance into the cell they land in, and later paths can terminate into a cell once it has
+ * gathered enough samples.
+ *
+ * Memory is allocated once on the first clear() and never grows. If a cell cannot find a free slot within
+ * a few probes the sample is simply dropped. All updates are lock-free, so every worker thread shares one cache.
+ */
+class RadianceCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 20;
+    static constexpr int MAX_PROBES          = 8;
+
+    /**
+     * Constructor
+     * @param capacity Number of cells, rounded up to a power of two
+     * @param minSamples Number of samples a cell needs before lookups return it
+     * @param maxRadiance Per-channel clamp applied to recorded samples to keep fireflies out of the cache
+     */
+    explicit RadianceCache(size_t capacity = DEFAULT_CAPACITY, int minSamples = 16, Float maxRadiance = 8.0f);
+
+    /**
+     * Clears all cells, allocating the table if needed
+     * @param cellSize World-space size of a grid cell
+     */
+    void clear(Float cellSize);
+
+    /**
+     * Adds a radiance sample to the cell containing p
+     * @param p World-space position
+     * @param n Surface normal
+     * @param radiance Outgoing radiance estimate
+     */
+    void record(const Vec3 &p, const Vec3 &n, const Vec3 &radiance);
+
+    /**
+     * Looks up the average radiance of the cell containing p
+     * @param p World-space position
+     * @param n Surface normal
+     * @param radiance Average radiance, if found
+     * @return True if the cell exists and has at least minSamples samples
+     */
+    bool lookup(const Vec3 &p, const Vec3 &n, Vec3 &radiance) const;
+
+    /**
+     * @return Number of bytes used by the table
+     */
+    [[nodiscard]] size_t memoryUsage() const;
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> key;
+        std::atomic<float> r, g, b;
+        std::atomic<uint32_t> count;
+    };
+
+    std::unique_ptr<Entry[]> entries_;
+    size_t capacity_;
+    int minSamples_;
+    Float maxRadiance_;
+    Float invCellSize_ = 1.0f;
+
+    [[nodiscard]] uint64_t key(const Vec3 &p, const Vec3 &n) const;
+};
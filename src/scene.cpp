@@ -2,12 +2,45 @@
 #include "mesh.hpp"
 #include <assimp/scene.h>
 #include "loader.hpp"
+#include "profile.hpp"
+
+#include <filesystem>
 
 static constexpr int SCENE_MATERIAL_LIMIT = 64;
 static const Vec3 GOLD_IOR                = {0.15557, 0.42415, 1.3831};
 static const Vec3 GOLD_K                  = {-3.6024, -2.4721, -1.9155};
 
-bool Scene::closestHit(const Ray &r, Interval t, SurfaceIntersection &record) const {
+static thread_local TraversalStats *traversalStats = nullptr;
+
+// Adds a traversal's work to the installed TraversalStats, compiled out of the uncounted traversal
+template<bool CountWork>
+struct StatsCounter {
+    void node() {}
+    void triangle() {}
+};
+
+template<>
+struct StatsCounter<true> {
+    TraversalStats &stats = *traversalStats;
+
+    void node() { ++stats.nodes; }
+    void triangle() { ++stats.triangles; }
+};
+
+void Scene::setTraversalStats(TraversalStats *stats) {
+    traversalStats = stats;
+}
+
+bool Scene::closestHit(const Ray &r, const Interval t, SurfaceIntersection &record) const {
+    return traversalStats ? closestHitImpl<true>(r, t, record) : closestHitImpl<false>(r, t, record);
+}
+
+bool Scene::anyHit(const Ray &r, const Interval t) const {
+    return traversalStats ? anyHitImpl<true>(r, t) : anyHitImpl<false>(r, t);
+}
+
+template<bool CountWork>
+bool Scene::closestHitImpl(const Ray &r, Interval t, SurfaceIntersection &record) const {
     const auto invDir     = 1 / r.dir;
     const int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0), static_cast<int>(invDir.z < 0)};
 
@@ -15,9 +48,13 @@ bool Scene::closestHit(const Ray &r, Interval t, SurfaceIntersection &record) co
     int currentNodeIndex = 0;
     int stack[64];
     bool hitAnything = false;
+    TraversalCounter counter;
+    StatsCounter<CountWork> stats;
 
     while (true) {
         const LinearBVHNode *node = &nodes_[currentNodeIndex];
+        counter.node();
+        stats.node();
         // 1. Check the ray intersects the current node
         //    If it doesn't, pop the stack and continue
         if (node->bbox.hit(r.origin, r.dir, t)) {
@@ -27,6 +64,8 @@ bool Scene::closestHit(const Ray &r, Interval t, SurfaceIntersection &record) co
                 // Leaf node
                 for (int i = 0; i < node->numPrimitives; ++i) {
                     const Triangle& tri = triangles_[node->primitivesOffset + i];
+                    counter.triangle();
+                    stats.triangle();
                     float u, v;
                     if (meshes[tri.meshIndex].tClosestHit(r, t, record, tri.index, u, v)) {
                         hitAnything = true;
@@ -54,20 +93,27 @@ bool Scene::closestHit(const Ray &r, Interval t, SurfaceIntersection &record) co
     return hitAnything;
 }
 
-bool Scene::anyHit(const Ray &r, const Interval t) const {
+template<bool CountWork>
+bool Scene::anyHitImpl(const Ray &r, const Interval t) const {
     const auto invDir     = 1 / r.dir;
     const int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0), static_cast<int>(invDir.z < 0)};
 
     int toVisitOffset    = 0;
     int currentNodeIndex = 0;
     int stack[64];
+    TraversalCounter counter;
+    StatsCounter<CountWork> stats;
 
     while (true) {
         const LinearBVHNode *node = &nodes_[currentNodeIndex];
+        counter.node();
+        stats.node();
         if (node->bbox.hit(r.origin, r.dir, t)) {
             if (node->numPrimitives > 0) {
                 for (int i = 0; i < node->numPrimitives; ++i) {
                     const Triangle& tri = triangles_[node->primitivesOffset + i];
+                    counter.triangle();
+                    stats.triangle();
                     if (meshes[tri.meshIndex].tAnyHit(r, t, tri.index)) {
                         return true;
                     }
@@ -93,7 +139,14 @@ bool Scene::anyHit(const Ray &r, const Interval t) const {
     return false;
 }
 
+size_t Scene::textureMemoryUsage() const {
+    size_t bytes = textureCache ? textureCache->stats().residentBytes : 0;
+    for (const auto &texture : textures) bytes += texture.memoryUsage();
+    return bytes;
+}
+
 void Scene::buildBVH(const int maxPrimsInNode) {
+    PROFILE_SCOPE("Build BVH");
     maxPrimsInNode_ = maxPrimsInNode;
     triangles_.resize(numPrimitives());
     // std::vector<Primitive> primitives(scene.numPrimitives());
@@ -109,19 +162,23 @@ void Scene::buildBVH(const int maxPrimsInNode) {
     // We will order as we build
     std::vector<Triangle> orderedPrimitives(triangles_.size());
 
-    int totalNodes             = 1;
-    int orderedPrimitiveOffset = 0;
+    std::atomic<int> totalNodes             = 1;
+    std::atomic<int> orderedPrimitiveOffset = 0;
 
     const BVHNode *root = buildTree(triangles_, &totalNodes, &orderedPrimitiveOffset, orderedPrimitives, maxPrimsInNode);
     triangles_.swap(orderedPrimitives);
 
-    nodes_     = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVH(root, nodes_, &offset);
+    {
+        PROFILE_SCOPE("Flatten BVH");
+        nodeCount_ = totalNodes;
+        nodes_     = new LinearBVHNode[nodeCount_];
+        int offset = 0;
+        flattenBVH(root, nodes_, &offset);
 
-    // Clean-up the tree
-    root->destroy();
-    delete root;
+        // Clean-up the tree
+        root->destroy();
+        delete root;
+    }
 
     bvhBuilt_ = true;
 
@@ -173,10 +230,10 @@ Scene createMeshScene() {
     return scene;
 }
 
-Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background) {
+Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background, const TextureCacheConfig &textureCache) {
     Scene scene;
-    scene.name = "File scene";
-    loadScene(path, scene);
+    scene.name = std::filesystem::path(path).filename().string();
+    loadScene(path, scene, textureCache);
 
     scene.cameraProperties.center        = Vec3(0, 0, 8);
     scene.cameraProperties.target        = Vec3(0, 0, 0);
@@ -187,16 +244,16 @@ Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background
 
     scene.skyColor = background;
 
-    std::cout << "Scene loaded with:" << std::endl;
-    std::cout << " - " << scene.meshes.size() << " meshes" << std::endl;
-    std::cout << " - " << scene.triangles.size() << " triangles" << std::endl;
+    std::clog << "Scene loaded with:" << std::endl;
+    std::clog << " - " << scene.meshes.size() << " meshes" << std::endl;
+    std::clog << " - " << scene.triangles.size() << " triangles" << std::endl;
 
     int numVertices = 0;
     for (const auto &mesh: scene.meshes) {
         numVertices += mesh.numVertices;
     }
 
-    std::cout << " - " << numVertices << " vertices" << std::endl;
+    std::clog << " - " << numVertices << " vertices" << std::endl;
 
     // Transform all verts and norms
     for (int i = 0; i < scene.meshes[0].numVertices; ++i) {
@@ -207,15 +264,15 @@ Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background
     return scene;
 }
 
-Scene createShaderBallScene(const bool highSubdivision) {
+Scene createShaderBallScene(const bool highSubdivision, const TextureCacheConfig &textureCache) {
     const auto t = Mat4::identity();
     Scene scene;
     if (highSubdivision) {
         const std::string path = "assets/scenes/shaderball/shaderball_hsd.obj";
-        scene                  = createScene(path, t);
+        scene                  = createScene(path, t, Vec3(0.7, 0.8, 1.0), textureCache);
     } else {
         const std::string path = "assets/scenes/shaderball/shaderball.obj";
-        scene                  = createScene(path, t);
+        scene                  = createScene(path, t, Vec3(0.7, 0.8, 1.0), textureCache);
     }
 
 
@@ -232,16 +289,16 @@ Scene createShaderBallScene(const bool highSubdivision) {
     return scene;
 }
 
-Scene createShaderBallSceneWithLight(const bool highSubdivision) {
+Scene createShaderBallSceneWithLight(const bool highSubdivision, const TextureCacheConfig &textureCache) {
 
     const auto t = Mat4::identity();
     Scene scene;
     if (highSubdivision) {
         const std::string path = "assets/scenes/shaderball/shaderball_hsd.obj";
-        scene                  = createScene(path, t);
+        scene                  = createScene(path, t, Vec3(0.7, 0.8, 1.0), textureCache);
     } else {
         const std::string path = "assets/scenes/shaderball/shaderball.obj";
-        scene                  = createScene(path, t);
+        scene                  = createScene(path, t, Vec3(0.7, 0.8, 1.0), textureCache);
     }
 
     scene.cameraProperties.center = Vec3(2.5, 16, 12);
@@ -273,10 +330,10 @@ Scene createShaderBallSceneWithLight(const bool highSubdivision) {
     return scene;
 }
 
-Scene createKnobScene() {
+Scene createKnobScene(const TextureCacheConfig &textureCache) {
     const auto t           = Mat4::identity();
     const std::string path = "assets/scenes/knob.obj";
-    auto scene             = createScene(path, t);
+    auto scene             = createScene(path, t, Vec3(0.7, 0.8, 1.0), textureCache);
 
     scene.cameraProperties.center = Vec3(0, 3, 8);
     scene.cameraProperties.target = Vec3(0, 0, 0);
@@ -3,6 +3,7 @@
 #include "material.hpp"
 #include "mesh.hpp"
 #include "primitives.hpp"
+#include "texcache.hpp"
 #include "lights/lights.hpp"
 #include "util/rand.hpp"
 
@@ -21,6 +22,14 @@ struct CameraProperties {
     Float focusDistance;
 };
 
+/**
+ * BVH work done by a thread's traversals, see Scene::setTraversalStats
+ */
+struct TraversalStats {
+    uint64_t nodes     = 0;
+    uint64_t triangles = 0;
+};
+
 class Scene {
 public:
     std::string name;
@@ -35,6 +44,9 @@ public:
 
     std::vector<TextureImage> textures;
 
+    // Serves texture tiles on demand when loaded with a texture budget, null otherwise
+    std::unique_ptr<TextureCache> textureCache;
+
     CameraProperties cameraProperties;
 
     void destroy() {
@@ -47,6 +59,12 @@ public:
     bool closestHit(const Ray &r, Interval t, SurfaceIntersection &record) const;
     bool anyHit(const Ray &r, Interval t) const;
 
+    /**
+     * Adds the work of the calling thread's closestHit/anyHit calls to stats, until called again with nullptr.
+     * Traversals check for it once per call, without it they run the uncounted version.
+     */
+    static void setTraversalStats(TraversalStats *stats);
+
     [[nodiscard]]
     int numPrimitives() const {
         return triangles.size();
@@ -58,6 +76,7 @@ public:
         if (bvhBuilt_) {
             delete[] nodes_;
             nodes_ = nullptr;
+            nodeCount_ = 0;
             bvhBuilt_ = false;
             triangles_.clear();
         }
@@ -83,15 +102,33 @@ public:
         return bounds().diagonal().len() / 2;
     }
 
+    /**
+     * @return Bytes used by the flattened BVH nodes and the triangles in BVH order
+     */
+    size_t bvhMemoryUsage() const {
+        return static_cast<size_t>(nodeCount_) * sizeof(LinearBVHNode) + triangles_.capacity() * sizeof(Triangle);
+    }
+
+    /**
+     * @return Bytes of texel data held in memory, by the textures themselves or by the texture cache
+     */
+    size_t textureMemoryUsage() const;
+
 private:
     bool bvhBuilt_ = false;
     int maxPrimsInNode_ = 0;
+    int nodeCount_ = 0;
     std::vector<Triangle> triangles_;
     LinearBVHNode *nodes_ = nullptr;
+
+    template<bool CountWork>
+    bool closestHitImpl(const Ray &r, Interval t, SurfaceIntersection &record) const;
+    template<bool CountWork>
+    bool anyHitImpl(const Ray &r, Interval t) const;
 };
 
 Scene createMeshScene();
-Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background = Vec3(0.7, 0.8, 1.0));
-Scene createShaderBallScene(bool highSubdivision = false);
-Scene createShaderBallSceneWithLight(bool highSubdivision = false);
-Scene createKnobScene();
\ No newline at end of file
+Scene createScene(const std::string &path, const Mat4 &t, const Vec3 &background = Vec3(0.7, 0.8, 1.0), const TextureCacheConfig &textureCache = {});
+Scene createShaderBallScene(bool highSubdivision = false, const TextureCacheConfig &textureCache = {});
+Scene createShaderBallSceneWithLight(bool highSubdivision = false, const TextureCacheConfig &textureCache = {});
+Scene createKnobScene(const TextureCacheConfig &textureCache = {});
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "scheduler.hpp"
+
+#include "profile.hpp"
+
+#include <algorithm>
+
+static std::atomic<int> globalThreadCount = 0;
+
+// Scheduler and deque index of the current thread, if it is a worker
+static thread_local const Scheduler *currentScheduler = nullptr;
+static thread_local int currentWorker                 = -1;
+
+void Scheduler::TaskGroup::run(Task task) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    scheduler_.submit([this, task = std::move(task)] {
+        task();
+        pending_.fetch_sub(1, std::memory_order_release);
+    });
+}
+
+void Scheduler::TaskGroup::wait() {
+    if (pending_.load(std::memory_order_acquire) == 0) return;
+
+    // Tasks the waiting thread picks up nest inside the zone, the gaps between them are time spent idle
+    PROFILE_SCOPE("Wait");
+    while (pending_.load(std::memory_order_acquire) > 0) {
+        // Only the tail of the group can be left running elsewhere, so spinning here is short
+        if (!scheduler_.runOne()) std::this_thread::yield();
+    }
+}
+
+Scheduler::Scheduler(const int threadCount) {
+    const int n = std::max(threadCount, 1);
+    for (int i = 0; i <= n; ++i) {
+        queues_.push_back(std::make_unique<TaskQueue>());
+    }
+
+    threads_.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        threads_.emplace_back(&Scheduler::workerLoop, this, i);
+    }
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard lock(sleepMutex_);
+        stop_ = true;
+    }
+    sleepCondition_.notify_all();
+    for (auto &thread : threads_) {
+        thread.join();
+    }
+}
+
+Scheduler &Scheduler::global() {
+    static Scheduler scheduler([] {
+        const int n = globalThreadCount.load();
+        return n > 0 ? n : std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }());
+    return scheduler;
+}
+
+void Scheduler::setGlobalThreadCount(const int threadCount) {
+    globalThreadCount = threadCount;
+}
+
+int Scheduler::workerIndex() const {
+    return currentScheduler == this ? currentWorker : -1;
+}
+
+void Scheduler::submit(Task task) {
+    const int worker = workerIndex();
+    auto &queue      = *queues_[worker >= 0 ? worker : queues_.size() - 1];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+
+    // Taking the lock orders the increment against a worker that is about to sleep
+    { std::lock_guard lock(sleepMutex_); }
+    sleepCondition_.notify_one();
+}
+
+void Scheduler::parallelFor(const size_t count, const std::function<void(size_t)> &body) {
+    TaskGroup group(*this);
+    for (size_t i = 0; i < count; ++i) {
+        group.run([&body, i] { body(i); });
+    }
+    group.wait();
+}
+
+bool Scheduler::runOne() {
+    if (queued_.load(std::memory_order_acquire) == 0) return false;
+
+    const int worker      = workerIndex();
+    const int queueCount  = static_cast<int>(queues_.size());
+    const int injectIndex = queueCount - 1;
+
+    Task task;
+    auto tryPop = [&](const int index, const bool back) {
+        auto &queue = *queues_[index];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        if (back) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    };
+
+    bool found = (worker >= 0 && tryPop(worker, true)) || tryPop(injectIndex, false);
+
+    // Steal, starting next to ourselves so thieves spread over the victims
+    const int start = worker + 1;
+    for (int i = 0; !found && i < injectIndex; ++i) {
+        const int victim = (start + i) % injectIndex;
+        if (victim != worker) found = tryPop(victim, false);
+    }
+    if (!found) return false;
+
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+}
+
+void Scheduler::workerLoop(const int index) {
+    currentScheduler = this;
+    currentWorker    = index;
+
+    while (true) {
+        if (runOne()) continue;
+
+        std::unique_lock lock(sleepMutex_);
+        sleepCondition_.wait(lock, [this] { return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+        if (stop_) return;
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Persistent work-stealing scheduler
+ *
+ * A fixed set of worker threads, each with its own task deque. A worker pushes and pops its own tasks at the
+ * back (so nested work stays hot in cache) and steals from the front of other deques once its own runs dry.
+ * Tasks submitted from outside the pool go into a shared injection queue and run in submission order.
+ *
+ * Threads that wait on a TaskGroup (or parallelFor) execute queued tasks while they wait, so nested parallel
+ * work never deadlocks the pool and the submitting thread adds to the throughput instead of sleeping.
+ */
+class Scheduler {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Counts a batch of tasks so they can be waited on together
+     */
+    class TaskGroup {
+    public:
+        explicit TaskGroup(Scheduler &scheduler = Scheduler::global())
+            : scheduler_(scheduler) {}
+        ~TaskGroup() { wait(); }
+
+        TaskGroup(const TaskGroup &)            = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        void run(Task task);
+
+        /**
+         * Blocks until every task run through this group has finished, executing queued tasks meanwhile
+         */
+        void wait();
+
+    private:
+        Scheduler &scheduler_;
+        std::atomic<int> pending_ = 0;
+    };
+
+    /**
+     * @param threadCount Number of worker threads, at least one is started
+     */
+    explicit Scheduler(int threadCount);
+    ~Scheduler();
+
+    Scheduler(const Scheduler &)            = delete;
+    Scheduler &operator=(const Scheduler &) = delete;
+
+    /**
+     * Process-wide scheduler shared by the cameras, the BVH build, the denoiser and the loader
+     */
+    static Scheduler &global();
+
+    /**
+     * Sets the number of worker threads of the global scheduler. Only has an effect before its first use.
+     */
+    static void setGlobalThreadCount(int threadCount);
+
+    [[nodiscard]] int threadCount() const { return static_cast<int>(threads_.size()); }
+
+    /**
+     * @return Index of the calling thread among this scheduler's workers, -1 for any other thread
+     */
+    [[nodiscard]] int workerIndex() const;
+
+    /**
+     * Queues a task without a way to wait on it
+     */
+    void submit(Task task);
+
+    /**
+     * Queues a callable and returns a future for its result. Waiting on the future does not execute other
+     * tasks, so avoid it from inside a task.
+     */
+    template<typename F>
+    auto async(F &&f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using R   = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto res  = task->get_future();
+        submit([task] { (*task)(); });
+        return res;
+    }
+
+    /**
+     * Runs body(i) for every i in [0, count) as one task each and returns once all of them have finished
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)> &body);
+
+private:
+    struct alignas(64) TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> threads_;
+    // One deque per worker, the last one is the injection queue for outside threads
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+    std::atomic<int> queued_ = 0;
+    std::mutex sleepMutex_;
+    std::condition_variable sleepCondition_;
+    bool stop_ = false;
+
+    void workerLoop(int index);
+
+    /**
+     * Pops a task, preferring the calling worker's own deque, then the injection queue, then stealing
+     * @return False if no task was found
+     */
+    bool runOne();
+};
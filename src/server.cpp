@@ -0,0 +1,437 @@
+#include "camera.hpp"
+#include "job.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static constexpr auto DEFAULT_SOCKET_PATH = "/tmp/jtx-render.sock";
+
+// How often a running job reports its progress to the client
+static constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(500);
+
+static void printUsage(const char *program) {
+    std::cout << "Usage: " << program << " [--socket <path>] [--threads <count>]\n"
+              << "\n"
+              << "Renders jobs sent over a Unix socket, keeping every scene it has loaded (with its BVH) in memory so\n"
+              << "later jobs on the same scene start rendering straight away.\n"
+              << "\n"
+              << "  --socket   Socket to listen on (default " << DEFAULT_SOCKET_PATH << ")\n"
+              << "  --threads  Worker threads, 0 for all cores (default 0)\n"
+              << "\n"
+              << "Clients send lines of text. `key = value` lines take the same settings as JTXHeadless job files and\n"
+              << "stay set for the connection, so later jobs only need the settings that change. The exception is\n"
+              << "threads, which --threads sets for every job. Commands:\n"
+              << "  render    Queue a job with the current settings\n"
+              << "  reset     Go back to the default settings\n"
+              << "  status    Report queued jobs and loaded scenes\n"
+              << "  shutdown  Finish the running job and stop the server\n"
+              << "\n"
+              << "Replies, one per line: queued <id> <position>, started <id>, progress <id> <percent>,\n"
+              << "done <id> <seconds> <path>, failed <id> <reason>, status <queued> <scenes>, error <message>\n";
+}
+
+/**
+ * Client connection, shared between the thread reading its commands and the jobs it has queued
+ */
+class Connection {
+public:
+    explicit Connection(const int fd) : fd_(fd) {}
+    ~Connection() { close(fd_); }
+
+    Connection(const Connection &)            = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    /**
+     * Sends one reply line. A client that has gone away is not an error, its jobs still render to their outputs.
+     */
+    void send(const std::string &line) {
+        std::lock_guard lock(mutex_);
+        if (closed_) return;
+
+        const std::string message = line + "\n";
+        for (size_t sent = 0; sent < message.size();) {
+            const ssize_t n = ::send(fd_, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                closed_ = true;
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    /**
+     * Reads the next line, without the line ending
+     * @return False once the client has disconnected
+     */
+    bool readLine(std::string &line) {
+        while (true) {
+            const auto newline = buffer_.find('\n');
+            if (newline != std::string::npos) {
+                line = buffer_.substr(0, newline);
+                buffer_.erase(0, newline + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                return true;
+            }
+
+            char chunk[4096];
+            const ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+            if (n <= 0) return false;
+            buffer_.append(chunk, static_cast<size_t>(n));
+        }
+    }
+
+    void shutdownSocket() const { ::shutdown(fd_, SHUT_RDWR); }
+
+private:
+    int fd_;
+    std::mutex mutex_;
+    bool closed_ = false;
+    // Received data past the last complete line, only touched by the reading thread
+    std::string buffer_;
+};
+
+struct QueuedJob {
+    int id;
+    RenderJob job;
+    std::shared_ptr<Connection> client;
+};
+
+/**
+ * Render server
+ *
+ * Connection threads parse commands and queue jobs; a single render thread takes them in order, so every job gets
+ * the whole scheduler. Scenes are only touched by the render thread, which keeps them loaded for later jobs.
+ */
+class RenderServer {
+public:
+    explicit RenderServer(std::string socketPath) : socketPath_(std::move(socketPath)) {}
+
+    ~RenderServer() {
+        for (auto &[key, cached] : scenes_) cached->scene.destroy();
+    }
+
+    /**
+     * Accepts clients until a shutdown command arrives
+     * @return False if the socket couldn't be set up
+     */
+    bool run();
+
+private:
+    struct CachedScene {
+        Scene scene;
+        // Modification time of the scene file when it was loaded, a newer file is loaded again
+        std::filesystem::file_time_type modified;
+        // Texture cache settings it was loaded with, jobs asking for different ones load it again
+        TextureCacheConfig textureCache;
+    };
+
+    std::string socketPath_;
+    int listenFd_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<QueuedJob> queue_;
+    int nextId_          = 1;
+    bool stop_           = false;
+    size_t loadedScenes_ = 0;
+    std::vector<std::shared_ptr<Connection>> clients_;
+    // Client threads that are done and can be joined
+    std::vector<std::thread::id> finishedClients_;
+
+    // Keyed by the job's scene setting, only used by the render thread. Held by pointer so a scene never moves
+    // once its BVH is built.
+    std::unordered_map<std::string, std::unique_ptr<CachedScene>> scenes_;
+
+    bool listen();
+    void serveClient(const std::shared_ptr<Connection> &client);
+    void renderLoop();
+    void renderJob(const QueuedJob &queued);
+
+    /**
+     * Loads the job's scene and builds its BVH, unless it is already loaded and its file hasn't changed since
+     * @return Nullptr if the scene can't be loaded
+     */
+    const Scene *scene(const RenderJob &job, bool &loaded);
+
+    void stop();
+};
+
+bool RenderServer::listen() {
+    if (socketPath_.size() >= sizeof(sockaddr_un::sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath_ << std::endl;
+        return false;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath_.c_str(), sizeof(address.sun_path) - 1);
+
+    // A socket file nobody answers on is left over from a server that didn't shut down cleanly
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool live = probe >= 0 && connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    if (probe >= 0) close(probe);
+    if (live) {
+        std::cerr << "A server is already listening on " << socketPath_ << std::endl;
+        return false;
+    }
+    unlink(socketPath_.c_str());
+
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd_ < 0 || bind(listenFd_, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || ::listen(listenFd_, 16) != 0) {
+        std::cerr << "Failed to listen on " << socketPath_ << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool RenderServer::run() {
+    if (!listen()) return false;
+    std::cout << "Listening on " << socketPath_ << " with " << Scheduler::global().threadCount() + 1 << " render threads" << std::endl;
+
+    std::thread renderThread(&RenderServer::renderLoop, this);
+    std::vector<std::thread> clientThreads;
+
+    while (true) {
+        const int fd = accept(listenFd_, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        auto client = std::make_shared<Connection>(fd);
+        {
+            std::lock_guard lock(mutex_);
+            if (stop_) break;
+            clients_.push_back(client);
+
+            // Reap the threads of clients that have disconnected since the last one connected
+            std::erase_if(clientThreads, [this](std::thread &thread) {
+                if (std::ranges::find(finishedClients_, thread.get_id()) == finishedClients_.end()) return false;
+                thread.join();
+                return true;
+            });
+            finishedClients_.clear();
+        }
+        clientThreads.emplace_back(&RenderServer::serveClient, this, client);
+    }
+
+    // Also covers accept() failing on its own
+    stop();
+    renderThread.join();
+    for (auto &thread : clientThreads) thread.join();
+    close(listenFd_);
+    unlink(socketPath_.c_str());
+    return true;
+}
+
+void RenderServer::stop() {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+    // Unblocks accept() and the client reads, jobs still queued are dropped
+    ::shutdown(listenFd_, SHUT_RDWR);
+    for (const auto &client : clients_) client->shutdownSocket();
+    for (const auto &queued : queue_) queued.client->send("failed " + std::to_string(queued.id) + " server shut down");
+    queue_.clear();
+    condition_.notify_all();
+}
+
+void RenderServer::serveClient(const std::shared_ptr<Connection> &client) {
+    RenderJob settings;
+    std::string line;
+    while (client->readLine(line)) {
+        if (line == "render") {
+            if (settings.output == "-" || !settings.animation.empty()) {
+                client->send("error stdout outputs and animations are rendered with JTXHeadless");
+                continue;
+            }
+
+            std::lock_guard lock(mutex_);
+            if (stop_) break;
+            const int id = nextId_++;
+            queue_.push_back({id, settings, client});
+            client->send("queued " + std::to_string(id) + " " + std::to_string(queue_.size()));
+            condition_.notify_one();
+        } else if (line == "reset") {
+            settings = RenderJob();
+        } else if (line == "status") {
+            std::lock_guard lock(mutex_);
+            client->send("status " + std::to_string(queue_.size()) + " " + std::to_string(loadedScenes_));
+        } else if (line == "shutdown") {
+            stop();
+            break;
+        } else {
+            // Jobs share the worker pool sized by --threads, so a per-job count would be silently ignored. The
+            // sentinel catches the setting however the key is spelled.
+            const int threads = settings.threads;
+            settings.threads  = -1;
+            const bool valid  = applyJobLine(settings, line);
+            const bool pooled = settings.threads == -1;
+            settings.threads  = threads;
+            if (!valid) {
+                client->send("error invalid setting: " + line);
+            } else if (!pooled) {
+                client->send("error threads is set for every job by the server's --threads");
+            }
+        }
+    }
+
+    std::lock_guard lock(mutex_);
+    std::erase(clients_, client);
+    finishedClients_.push_back(std::this_thread::get_id());
+}
+
+void RenderServer::renderLoop() {
+    while (true) {
+        QueuedJob queued;
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return !queue_.empty() || stop_; });
+            if (stop_) return;
+            queued = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        renderJob(queued);
+    }
+}
+
+const Scene *RenderServer::scene(const RenderJob &job, bool &loaded) {
+    std::error_code ec;
+    const auto modified = std::filesystem::last_write_time(job.scene, ec);
+
+    loaded       = false;
+    auto &cached = scenes_[job.scene];
+    const bool sameTextures = cached && cached->textureCache.budgetBytes == job.textureCache.budgetBytes &&
+                              cached->textureCache.directory == job.textureCache.directory;
+    if (cached && sameTextures && (ec || cached->modified == modified)) return &cached->scene;
+
+    // Only the scene itself is cached, the camera overrides are applied per job
+    RenderJob sceneJob;
+    sceneJob.scene        = job.scene;
+    sceneJob.textureCache = job.textureCache;
+    auto fresh            = std::make_unique<CachedScene>();
+    if (!loadJobScene(sceneJob, fresh->scene)) {
+        if (!cached) scenes_.erase(job.scene);
+        return nullptr;
+    }
+    fresh->scene.buildBVH();
+    fresh->modified     = modified;
+    fresh->textureCache = job.textureCache;
+    loaded              = true;
+
+    if (cached) cached->scene.destroy();
+    cached = std::move(fresh);
+
+    std::lock_guard lock(mutex_);
+    loadedScenes_ = scenes_.size();
+    return &cached->scene;
+}
+
+void RenderServer::renderJob(const QueuedJob &queued) {
+    const RenderJob &job = queued.job;
+    const std::string id = std::to_string(queued.id);
+    auto &client         = *queued.client;
+    client.send("started " + id);
+
+    const auto start = std::chrono::steady_clock::now();
+    bool loaded;
+    const Scene *scene = this->scene(job, loaded);
+    if (!scene) {
+        client.send("failed " + id + " scene not found: " + job.scene);
+        return;
+    }
+    const auto ready = std::chrono::steady_clock::now();
+    std::cout << "Job " << id << ": " << job.scene << (loaded ? " loaded in " : " cached, ready in ")
+              << std::chrono::duration<double>(ready - start).count() << "s" << std::endl;
+
+    const auto [xSamples, ySamples] = strataForSpp(job.spp);
+    StaticCamera camera{job.width, job.height, jobCamera(job, scene->cameraProperties), xSamples, ySamples, job.maxDepth};
+    applyJobSettings(job, camera);
+
+    // The render blocks this thread, so progress is reported from a second one
+    std::mutex progressMutex;
+    std::condition_variable progressCondition;
+    bool rendering = true;
+    std::thread progressThread([&] {
+        int reported = -1;
+        std::unique_lock lock(progressMutex);
+        while (!progressCondition.wait_for(lock, PROGRESS_INTERVAL, [&] { return !rendering; })) {
+            const int percent = static_cast<int>(camera.progress() * 100);
+            if (percent != reported) client.send("progress " + id + " " + std::to_string(percent));
+            reported = percent;
+        }
+    });
+
+    camera.render(*scene);
+    {
+        std::lock_guard lock(progressMutex);
+        rendering = false;
+    }
+    progressCondition.notify_one();
+    progressThread.join();
+
+    if (!writeJobOutput(job, camera)) {
+        client.send("failed " + id + " could not write output");
+        return;
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::ostringstream reply;
+    reply << "done " << id << " " << seconds << " " << (job.film.empty() ? job.output : job.film);
+    client.send(reply.str());
+}
+
+int main(int argc, char *argv[]) {
+    std::string socketPath = DEFAULT_SOCKET_PATH;
+    int threads            = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (arg == "--socket") {
+            socketPath = argv[++i];
+        } else if (arg == "--threads") {
+            if (!parseNumber(argv[++i], threads) || threads < 0) {
+                std::cerr << "Invalid value for --threads: " << argv[i] << std::endl;
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else {
+            std::cerr << "Unexpected argument: " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Writes to a client that has disconnected must fail rather than kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (threads > 0) Scheduler::setGlobalThreadCount(threads);
+
+    RenderServer server(socketPath);
+    return server.run() ? 0 : 1;
+}
@@ -0,0 +1,329 @@
+#include "texcache.hpp"
+#include "image.hpp"
+#include "profile.hpp"
+#include "util/hash.hpp"
+
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static constexpr char TILE_FILE_MAGIC[4]    = {'J', 'T', 'X', 'T'};
+static constexpr uint32_t TILE_FILE_VERSION = 1;
+
+struct TileFileHeader {
+    char magic[4];
+    uint32_t version;
+    int32_t width, height, channels;
+    int32_t format, encoding;
+    int32_t tileSize;
+    int32_t numLevels;
+    int32_t levelSizes[TextureCache::MAX_LEVELS][2];
+};
+
+// Distinguishes caches so a thread's front never serves tiles of a cache that has since been replaced
+static std::atomic<uint64_t> nextCacheId = 1;
+
+// Recently used tiles of the calling thread, replaced least-recently-used so that the (at most 8) tiles touched by
+// a single trilinear lookup stay alive until it finishes
+struct TileFront {
+    uint64_t cacheId = 0;
+    uint64_t clock   = 0;
+    // Hits not yet added to hitCounter, the counter of the cache the front belongs to
+    uint64_t hits = 0;
+    std::shared_ptr<std::atomic<uint64_t>> hitCounter;
+    uint64_t keys[TextureCache::FRONT_SIZE];
+    uint64_t lastUse[TextureCache::FRONT_SIZE];
+    std::shared_ptr<const void> tiles[TextureCache::FRONT_SIZE];
+    const uint8_t *data[TextureCache::FRONT_SIZE];
+};
+
+static thread_local TileFront front;
+
+static void flushFrontHits() {
+    if (front.hits == 0) return;
+    front.hitCounter->fetch_add(front.hits, std::memory_order_relaxed);
+    front.hits = 0;
+}
+
+static uint64_t tileKey(const int id, const int level, const int tx, const int ty) {
+    return (static_cast<uint64_t>(id) << 40) | (static_cast<uint64_t>(level) << 32) |
+           (static_cast<uint64_t>(ty & 0xFFFF) << 16) | static_cast<uint64_t>(tx & 0xFFFF);
+}
+
+TextureCache::TextureCache(const TextureCacheConfig &config)
+    : id_(nextCacheId.fetch_add(1)),
+      config_(config) {
+    std::error_code ec;
+    fs::create_directories(config_.directory, ec);
+    if (ec) {
+        std::cerr << "Failed to create texture cache directory: " << config_.directory << std::endl;
+    }
+}
+
+std::string TextureCache::fileKey(const std::string &path) {
+    std::error_code ec;
+    const auto size  = fs::file_size(path, ec);
+    const auto mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    return path + ":" + std::to_string(size) + ":" + std::to_string(mtime);
+}
+
+std::string TextureCache::filePath(const std::string &key) const {
+    const uint64_t h = detail::murmurHash64A(reinterpret_cast<const unsigned char *>(key.data()), key.size(), 0);
+
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.jtxt", static_cast<unsigned long long>(h));
+    return (fs::path(config_.directory) / name).string();
+}
+
+static bool readHeader(std::ifstream &in, TileFileHeader &header) {
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (std::memcmp(header.magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC)) != 0) return false;
+    return header.version == TILE_FILE_VERSION && header.numLevels > 0 && header.numLevels <= TextureCache::MAX_LEVELS;
+}
+
+bool TextureCache::open(const std::string &key, TextureImage &texture) {
+    const std::string path = filePath(key);
+
+    std::ifstream in(path, std::ios::binary);
+    TileFileHeader header;
+    if (!in || !readHeader(in, header) || header.tileSize != config_.tileSize) return false;
+
+    texture.path_     = path;
+    texture.width_    = header.width;
+    texture.height_   = header.height;
+    texture.channels_ = header.channels;
+    texture.format_   = static_cast<TexelFormat>(header.format);
+    texture.encoding_ = static_cast<ColorEncoding>(header.encoding);
+    texture.data_.clear();
+
+    texture.levels_.clear();
+    size_t offset = 0;
+    for (int l = 0; l < header.numLevels; ++l) {
+        const int w = header.levelSizes[l][0];
+        const int h = header.levelSizes[l][1];
+        texture.levels_.push_back({w, h, offset});
+        offset += static_cast<size_t>(w) * h * header.channels;
+    }
+
+    return attach(path, texture) >= 0;
+}
+
+bool TextureCache::add(const std::string &key, TextureImage &texture) {
+    if (texture.cached() || texture.levels_.empty()) return false;
+    PROFILE_SCOPE("Tile texture");
+
+    const std::string path = filePath(key);
+
+    // Reuse a file converted by an earlier run if it matches
+    bool valid = false;
+    {
+        std::ifstream in(path, std::ios::binary);
+        TileFileHeader header;
+        valid = in && readHeader(in, header) && header.tileSize == config_.tileSize &&
+                header.width == texture.width_ && header.height == texture.height_ &&
+                header.channels == texture.channels_ && header.numLevels == texture.levels() &&
+                header.format == static_cast<int32_t>(texture.format_) &&
+                header.encoding == static_cast<int32_t>(texture.encoding_);
+    }
+
+    if (!valid && !write(path, texture)) {
+        std::cerr << "Failed to write tiled texture: " << path << std::endl;
+        return false;
+    }
+
+    if (attach(path, texture) < 0) return false;
+
+    // Texels are served from disk from now on
+    texture.data_.clear();
+    texture.data_.shrink_to_fit();
+    return true;
+}
+
+bool TextureCache::write(const std::string &path, const TextureImage &texture) const {
+    if (texture.levels() > MAX_LEVELS) return false;
+
+    TileFileHeader header{};
+    std::memcpy(header.magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC));
+    header.version   = TILE_FILE_VERSION;
+    header.width     = texture.width_;
+    header.height    = texture.height_;
+    header.channels  = texture.channels_;
+    header.format    = static_cast<int32_t>(texture.format_);
+    header.encoding  = static_cast<int32_t>(texture.encoding_);
+    header.tileSize  = config_.tileSize;
+    header.numLevels = texture.levels();
+    for (int l = 0; l < header.numLevels; ++l) {
+        header.levelSizes[l][0] = texture.levels_[l].width;
+        header.levelSizes[l][1] = texture.levels_[l].height;
+    }
+
+    // Write to a temporary file first so a crash never leaves a truncated file behind
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    const int ts            = config_.tileSize;
+    const size_t texelBytes = texture.channels_ * texture.elementSize();
+    std::vector<uint8_t> tile(static_cast<size_t>(ts) * ts * texelBytes);
+
+    // Tiles are stored level by level in row-major order, edge tiles are padded to full size
+    for (int l = 0; l < header.numLevels; ++l) {
+        const auto &level = texture.levels_[l];
+        const int tilesX  = (level.width + ts - 1) / ts;
+        const int tilesY  = (level.height + ts - 1) / ts;
+
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                std::ranges::fill(tile, 0);
+                const int w = jtx::min(ts, level.width - tx * ts);
+                const int h = jtx::min(ts, level.height - ty * ts);
+                for (int y = 0; y < h; ++y) {
+                    const uint8_t *src = texture.data_.data() + texture.texelIndex(level, tx * ts, ty * ts + y) * texture.elementSize();
+                    std::memcpy(tile.data() + static_cast<size_t>(y) * ts * texelBytes, src, w * texelBytes);
+                }
+                out.write(reinterpret_cast<const char *>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+        }
+    }
+
+    out.close();
+    if (!out) return false;
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+int TextureCache::attach(const std::string &path, TextureImage &texture) {
+    auto file        = std::make_unique<File>();
+    file->path       = path;
+    file->texelBytes = texture.channels_ * texture.elementSize();
+    file->tileBytes  = static_cast<size_t>(config_.tileSize) * config_.tileSize * file->texelBytes;
+    file->dataOffset = sizeof(TileFileHeader);
+
+    size_t base = 0;
+    for (int l = 0; l < texture.levels(); ++l) {
+        const auto &level       = texture.levels_[l];
+        file->tilesX[l]        = (level.width + config_.tileSize - 1) / config_.tileSize;
+        file->levelTileBase[l] = base;
+        base += static_cast<size_t>(file->tilesX[l]) * ((level.height + config_.tileSize - 1) / config_.tileSize);
+    }
+
+    file->stream.open(path, std::ios::binary);
+    if (!file->stream) return -1;
+
+    std::lock_guard lock(filesMutex_);
+    files_.push_back(std::move(file));
+    texture.cache_   = this;
+    texture.cacheId_ = static_cast<int>(files_.size()) - 1;
+    return texture.cacheId_;
+}
+
+const uint8_t *TextureCache::texel(const int id, const int level, const int x, const int y) const {
+    const int ts       = config_.tileSize;
+    const uint64_t key = tileKey(id, level, x / ts, y / ts);
+
+    if (front.cacheId != id_) {
+        // The previous cache may be gone by now, the front holds on to its counter
+        flushFrontHits();
+        front            = {};
+        front.cacheId    = id_;
+        front.hitCounter = hits_;
+    }
+
+    const size_t offset = (static_cast<size_t>(y % ts) * ts + x % ts) * files_[id]->texelBytes;
+    for (int i = 0; i < FRONT_SIZE; ++i) {
+        if (front.data[i] && front.keys[i] == key) {
+            if (++front.hits == FRONT_FLUSH_HITS) flushFrontHits();
+            front.lastUse[i] = ++front.clock;
+            return front.data[i] + offset;
+        }
+    }
+
+    // Flush the thread's front hits while we're on the slow path anyway
+    flushFrontHits();
+
+    const auto tile = fetch(key, id, level, x / ts, y / ts);
+
+    int slot = 0;
+    for (int i = 1; i < FRONT_SIZE; ++i) {
+        if (front.lastUse[i] < front.lastUse[slot]) slot = i;
+    }
+
+    front.keys[slot]    = key;
+    front.lastUse[slot] = ++front.clock;
+    front.data[slot]    = tile->data.data();
+    front.tiles[slot]   = tile;
+    return front.data[slot] + offset;
+}
+
+void TextureCache::setBudget(const size_t budgetBytes) {
+    std::lock_guard lock(mutex_);
+    config_.budgetBytes = budgetBytes;
+    evict();
+}
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::fetch(const uint64_t key, const int id, const int level, const int tx, const int ty) const {
+    {
+        std::lock_guard lock(mutex_);
+        const auto it = table_.find(key);
+        if (it != table_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            hits_->fetch_add(1, std::memory_order_relaxed);
+            return it->second->tile;
+        }
+    }
+
+    // Read outside the table lock so other threads keep hitting resident tiles
+    auto tile = read(id, level, tx, ty);
+    misses_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard lock(mutex_);
+    if (const auto it = table_.find(key); it != table_.end()) {
+        // Another thread loaded it in the meantime
+        return it->second->tile;
+    }
+
+    lru_.push_front({key, tile});
+    table_[key] = lru_.begin();
+    residentBytes_ += tile->data.size();
+    evict();
+
+    return tile;
+}
+
+void TextureCache::evict() const {
+    while (residentBytes_ > config_.budgetBytes && lru_.size() > 1) {
+        const Entry &victim = lru_.back();
+        residentBytes_ -= victim.tile->data.size();
+        table_.erase(victim.key);
+        lru_.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::shared_ptr<const TextureCache::Tile> TextureCache::read(const int id, const int level, const int tx, const int ty) const {
+    File &file = *files_[id];
+
+    auto tile = std::make_shared<Tile>();
+    tile->data.resize(file.tileBytes);
+
+    const size_t index = file.levelTileBase[level] + static_cast<size_t>(ty) * file.tilesX[level] + tx;
+    std::lock_guard lock(file.mutex);
+    file.stream.clear();
+    file.stream.seekg(static_cast<std::streamoff>(file.dataOffset + index * file.tileBytes));
+    if (!file.stream.read(reinterpret_cast<char *>(tile->data.data()), static_cast<std::streamsize>(file.tileBytes))) {
+        // Serve black rather than crash mid-render, the file was truncated or removed
+        std::cerr << "Failed to read texture tile from " << file.path << std::endl;
+        std::ranges::fill(tile->data, 0);
+    }
+    return tile;
+}
+
+TextureCache::Stats TextureCache::stats() const {
+    std::lock_guard lock(mutex_);
+    return {hits_->load(std::memory_order_relaxed), misses_.load(std::memory_order_relaxed),
+            evictions_.load(std::memory_order_relaxed), residentBytes_, config_.budgetBytes};
+}
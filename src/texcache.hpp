@@ -0,0 +1,152 @@
+#pragma once
+
+#include "rt.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class TextureImage;
+
+struct TextureCacheConfig {
+    // Maximum number of bytes of tiles kept resident, 0 keeps textures fully in memory
+    size_t budgetBytes = 0;
+    // Directory holding the tiled texture files
+    std::string directory = ".texcache";
+    // Tile edge length in texels
+    int tileSize = 64;
+};
+
+/**
+ * Demand-loaded texture cache
+ *
+ * Each texture is converted once into a tiled MIP file on disk. At render time only the tiles that are actually
+ * touched are read back, and tiles are evicted least-recently-used once the resident size exceeds the budget.
+ *
+ * Lookups first go through a small per-thread front so that the shared table (and its lock) is only hit when
+ * a thread moves to a tile it hasn't touched recently. Tiles are reference counted: evicting a tile from the
+ * shared table never invalidates a pointer a thread is still using.
+ */
+class TextureCache {
+public:
+    static constexpr int FRONT_SIZE = 16;
+    static constexpr int MAX_LEVELS = 32;
+    // Front hits a thread counts before adding them to the shared total
+    static constexpr uint64_t FRONT_FLUSH_HITS = 1024;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t residentBytes;
+        size_t budgetBytes;
+    };
+
+    explicit TextureCache(const TextureCacheConfig &config);
+
+    TextureCache(const TextureCache &)            = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    /**
+     * Attaches a texture to an existing tiled file, skipping decoding entirely
+     * @param key Identifies the source image, see fileKey()
+     * @param texture Texture to attach, receives the metadata stored in the file
+     * @return True if a valid tiled file exists for the key
+     */
+    bool open(const std::string &key, TextureImage &texture);
+
+    /**
+     * Converts a decoded texture to a tiled file (unless one exists already) and attaches it.
+     * The texture's in-memory texels are released.
+     * @param key Identifies the source image, see fileKey()
+     * @param texture Decoded texture with its MIP pyramid built
+     * @return True on success, on failure the texture is left in memory
+     */
+    bool add(const std::string &key, TextureImage &texture);
+
+    /**
+     * Returns a pointer to the first channel of a texel. The pointer stays valid until the calling thread has
+     * touched FRONT_SIZE other tiles.
+     * @param id Texture id returned when the texture was attached
+     * @param level MIP level
+     * @param x Wrapped texel column
+     * @param y Wrapped texel row
+     */
+    const uint8_t *texel(int id, int level, int x, int y) const;
+
+    /**
+     * Hits are counted per thread and added to the totals every FRONT_FLUSH_HITS hits, so each thread's most
+     * recent hits may be missing
+     */
+    [[nodiscard]] Stats stats() const;
+
+    /**
+     * Changes the resident size limit, evicting least-recently-used tiles right away if it shrinks. Safe to call
+     * while rendering, tiles in use stay alive until the threads holding them move on.
+     */
+    void setBudget(size_t budgetBytes);
+
+    /**
+     * Builds the cache key of an image file from its path, size and modification time, so edited files are
+     * converted again
+     */
+    static std::string fileKey(const std::string &path);
+
+private:
+    struct Tile {
+        std::vector<uint8_t> data;
+    };
+
+    struct File {
+        std::string path;
+        size_t texelBytes;
+        size_t tileBytes;
+        size_t dataOffset;
+        int tilesX[MAX_LEVELS];
+        size_t levelTileBase[MAX_LEVELS];
+
+        std::mutex mutex;
+        std::ifstream stream;
+    };
+
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<const Tile> tile;
+    };
+
+    uint64_t id_;
+    TextureCacheConfig config_;
+    // Guards attaching files, which may happen from several loader threads. Rendering only reads files_.
+    std::mutex filesMutex_;
+    std::vector<std::unique_ptr<File>> files_;
+
+    mutable std::mutex mutex_;
+    mutable std::list<Entry> lru_;
+    mutable std::unordered_map<uint64_t, std::list<Entry>::iterator> table_;
+    mutable size_t residentBytes_ = 0;
+
+    // Shared with the threads' fronts, which add their hits in batches and may outlive the cache
+    std::shared_ptr<std::atomic<uint64_t>> hits_ = std::make_shared<std::atomic<uint64_t>>(0);
+    mutable std::atomic<uint64_t> misses_        = 0;
+    mutable std::atomic<uint64_t> evictions_ = 0;
+
+    [[nodiscard]] std::string filePath(const std::string &key) const;
+
+    bool write(const std::string &path, const TextureImage &texture) const;
+
+    int attach(const std::string &path, TextureImage &texture);
+
+    std::shared_ptr<const Tile> fetch(uint64_t key, int id, int level, int tx, int ty) const;
+
+    std::shared_ptr<const Tile> read(int id, int level, int tx, int ty) const;
+
+    /**
+     * Drops least-recently-used tiles until the resident size fits the budget, called with mutex_ held
+     */
+    void evict() const;
+};
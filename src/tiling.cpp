@@ -0,0 +1,104 @@
+#include "tiling.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <numeric>
+
+static uint32_t mortonIndex(const uint32_t x, const uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+// Position of (x, y) along the Hilbert curve filling an n x n grid, n a power of two
+static uint64_t hilbertIndex(const uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        const uint32_t rx = (x & s) > 0;
+        const uint32_t ry = (y & s) > 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the sub-curve connects to its neighbours
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+std::vector<uint32_t> tileSchedule(const int tilesX, const int tilesY, const TileOrder order) {
+    std::vector<uint32_t> schedule(static_cast<size_t>(tilesX) * tilesY);
+    std::iota(schedule.begin(), schedule.end(), 0);
+    if (order == TileOrder::ROW_MAJOR) return schedule;
+
+    // Curves are defined over a power of two square, tiles outside the image simply don't appear
+    const uint32_t n = std::bit_ceil(static_cast<uint32_t>(std::max(tilesX, tilesY)));
+    std::vector<uint64_t> keys(schedule.size());
+    for (uint32_t i = 0; i < schedule.size(); ++i) {
+        const uint32_t x = i % tilesX;
+        const uint32_t y = i / tilesX;
+        keys[i]          = order == TileOrder::MORTON ? mortonIndex(x, y) : hilbertIndex(n, x, y);
+    }
+
+    std::ranges::sort(schedule, [&](const uint32_t a, const uint32_t b) { return keys[a] < keys[b]; });
+    return schedule;
+}
+
+int chooseTileSize(const int width, const int height, const int tileSize, const std::vector<int64_t> &costs,
+                   const int threads, const int remainingPasses, const TileTuning &tuning) {
+    const int tilesX = (width + tileSize - 1) / tileSize;
+
+    int best        = tileSize;
+    double bestTime = std::numeric_limits<double>::max();
+
+    for (const int size : tuning.candidates) {
+        const int candX = (width + size - 1) / size;
+        const int candY = (height + size - 1) / size;
+        const int count = candX * candY;
+        if (count < tuning.minTilesPerThread * threads && size != tuning.candidates.front()) continue;
+
+        // Spread each measured tile's cost over its pixels and sum what falls inside the candidate tile
+        double total   = 0;
+        double maxTile = 0;
+        for (int ty = 0; ty < candY; ++ty) {
+            for (int tx = 0; tx < candX; ++tx) {
+                const int x0 = tx * size, x1 = std::min(x0 + size, width);
+                const int y0 = ty * size, y1 = std::min(y0 + size, height);
+
+                double cost = 0;
+                for (int my = y0 / tileSize; my * tileSize < y1; ++my) {
+                    for (int mx = x0 / tileSize; mx * tileSize < x1; ++mx) {
+                        const int mx0 = mx * tileSize, mx1 = std::min(mx0 + tileSize, width);
+                        const int my0 = my * tileSize, my1 = std::min(my0 + tileSize, height);
+
+                        const double overlap = static_cast<double>(std::min(x1, mx1) - std::max(x0, mx0)) * (std::min(y1, my1) - std::max(y0, my0));
+                        const double area    = static_cast<double>(mx1 - mx0) * (my1 - my0);
+                        cost += static_cast<double>(costs[my * tilesX + mx]) * overlap / area;
+                    }
+                }
+                total += cost;
+                maxTile = std::max(maxTile, cost);
+            }
+        }
+
+        // Passes run back to back, so only the final one leaves threads idle, for about one tile
+        const double perPass = (total + count * tuning.tileOverheadNs) / threads;
+        const double time    = remainingPasses * perPass + maxTile;
+        if (time < bestTime) {
+            bestTime = time;
+            best     = size;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Order in which tiles are handed to the render threads
+ */
+enum class TileOrder {
+    ROW_MAJOR,
+    // Z-order curve, cheap and mostly local but with long jumps between quadrants
+    MORTON,
+    // Hilbert curve, consecutive tiles are always neighbours
+    HILBERT,
+};
+
+/**
+ * Lists the tiles of a tilesX x tilesY grid in the given order
+ * @return Row-major tile indices, in the order they should be rendered
+ */
+std::vector<uint32_t> tileSchedule(int tilesX, int tilesY, TileOrder order);
+
+struct TileTuning {
+    // Candidate tile sizes, the tuner picks one of these
+    std::vector<int> candidates = {16, 32, 64, 128};
+    // Fewer tiles than this per thread and threads run out of work once the queue drains
+    int minTilesPerThread = 4;
+    // Fixed cost of taking a tile: queue traffic, cold caches, the resolve and checkpoint copies
+    double tileOverheadNs = 50'000;
+};
+
+/**
+ * Picks the tile size for the rest of a render from the cost of each tile in the first pass
+ *
+ * Larger tiles cut the per-tile overhead, smaller ones shorten the tail at the end of the render where the
+ * last, most expensive tiles finish on few threads. Costs of the measured tiles are spread over their area
+ * to estimate the cost of the tiles of each candidate size.
+ *
+ * @param width Image width
+ * @param height Image height
+ * @param tileSize Tile size of the measured pass
+ * @param costs Time taken by each tile of the measured pass (row-major), in nanoseconds
+ * @param threads Number of render threads
+ * @param remainingPasses Passes still to be rendered after the measured one
+ * @param tuning Candidates and cost model constants
+ * @return Chosen tile size
+ */
+int chooseTileSize(int width, int height, int tileSize, const std::vector<int64_t> &costs, int threads, int remainingPasses, const TileTuning &tuning = {});
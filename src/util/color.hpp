@@ -2,6 +2,8 @@
 
 #include "../rt.hpp"
 
+#include <array>
+
 static constexpr Float RGB_SCALE = 255.999;
 
 namespace Color {
@@ -10,14 +12,46 @@ static const auto BLACK = Vec3(0, 0, 0);
 static const auto SKY_BLUE = Vec3(0.529, 0.808, 0.922);
 };
 
+// Rec. 709 relative luminance of a linear RGB colour
+inline Float luminance(const Vec3 &c) {
+    return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+inline float sRGBToLinear(const float srgb) {
+    if (srgb <= 0.04045f) return srgb / 12.92f;
+    return jtx::pow((srgb + 0.055f) / 1.055f, 2.4f);
+}
+
 inline Vec3 sRGBToLinear(const Vec3 &srgb) {
     Vec3 linear;
     for (int i = 0; i < 3; ++i) {
-        if (srgb[i] <= 0.04045f) {
-            linear[i] = srgb[i] / 12.92f;
-        } else {
-            linear[i] = jtx::pow((srgb[i] + 0.055f) / 1.055f, 2.4f);
-        }
+        linear[i] = sRGBToLinear(srgb[i]);
     }
     return linear;
 }
+
+inline float linearToSRGB(const float linear) {
+    if (linear <= 0.0031308f) return linear * 12.92f;
+    return 1.055f * jtx::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+// Decodes 8-bit sRGB values straight to linear
+inline const std::array<float, 256> SRGB8_TO_LINEAR = [] {
+    std::array<float, 256> lut{};
+    for (int i = 0; i < 256; ++i) {
+        lut[i] = sRGBToLinear(static_cast<float>(i) / 255.0f);
+    }
+    return lut;
+}();
+
+// False colour ramp for heatmaps, t in [0, 1] goes black -> blue -> cyan -> green -> yellow -> red. Returns
+// display values, square them for the gamma 2 image conversion.
+inline Vec3 heatmapColor(const Float t) {
+    static const Vec3 stops[] = {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+    constexpr int last        = static_cast<int>(std::size(stops)) - 1;
+
+    const Float x = jtx::clamp(t, 0.0f, 1.0f) * static_cast<Float>(last);
+    const int i   = jtx::min(static_cast<int>(x), last - 1);
+    const Float f = x - static_cast<Float>(i);
+    return stops[i] * (1 - f) + stops[i + 1] * f;
+}
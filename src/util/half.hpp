@@ -0,0 +1,55 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+// IEEE 754 binary16 conversions, used for packed HDR texture storage
+// floatToHalf rounds to nearest even, based on:
+//  - https://gist.github.com/rygorous/2156668
+inline uint16_t floatToHalf(const float x) {
+    uint32_t f          = std::bit_cast<uint32_t>(x);
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint32_t h;
+    if (f >= 0x47800000u) {
+        // Overflow, Inf or NaN
+        h = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+    } else if (f < 0x38800000u) {
+        // Subnormal or zero, let the FPU do the rounding
+        constexpr uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        const float rounded            = std::bit_cast<float>(f) + std::bit_cast<float>(denormMagic);
+        h                              = std::bit_cast<uint32_t>(rounded) - denormMagic;
+    } else {
+        // Normal, rebias exponent and round mantissa
+        const uint32_t mantissaOdd = (f >> 13) & 1;
+        f += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff;
+        f += mantissaOdd;
+        h = f >> 13;
+    }
+
+    return static_cast<uint16_t>(h | (sign >> 16));
+}
+
+inline float halfToFloat(const uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+    uint32_t exponent   = (h >> 10) & 0x1fu;
+    uint32_t mantissa   = h & 0x3ffu;
+
+    if (exponent == 0) {
+        if (mantissa == 0) return std::bit_cast<float>(sign);
+
+        // Subnormal, normalize it
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400u)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        mantissa &= 0x3ffu;
+        return std::bit_cast<float>(sign | (exponent << 23) | (mantissa << 13));
+    }
+
+    if (exponent == 31) return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue
+ *
+ * Each cell carries a sequence number telling producers and consumers whose turn it is, so a push or pop is a
+ * single CAS on the shared position plus a store to the cell. Both fail instead of blocking when the queue is
+ * full or empty.
+ *
+ * See: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template<typename T>
+class MPMCQueue {
+public:
+    /**
+     * @param capacity Maximum number of elements, rounded up to a power of two
+     */
+    explicit MPMCQueue(const size_t capacity)
+        : mask_(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+          cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCQueue(const MPMCQueue &)            = delete;
+    MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+    bool push(const T &value) {
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell       = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff  = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T &value) {
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell       = cells_[pos & mask_];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff  = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.data;
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    // Kept on separate cache lines so producers and consumers don't contend
+    alignas(64) std::atomic<size_t> enqueuePos_ = 0;
+    alignas(64) std::atomic<size_t> dequeuePos_ = 0;
+};